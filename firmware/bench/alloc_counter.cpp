@@ -0,0 +1,34 @@
+#include "alloc_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    std::atomic<std::size_t> g_Allocations{0};
+
+    void* countedAlloc(std::size_t size) noexcept {
+        g_Allocations.fetch_add(1, std::memory_order_relaxed);
+        return std::malloc(size ? size : 1);
+    }
+
+    void* countedAllocOrThrow(std::size_t size) {
+        if (void* p = countedAlloc(size)) {
+            return p;
+        }
+        throw std::bad_alloc();
+    }
+}
+
+std::size_t allocationCount() {
+    return g_Allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) { return countedAllocOrThrow(size); }
+void* operator new[](std::size_t size) { return countedAllocOrThrow(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// Number of times the global operator new has been called in this process.
+// Linking alloc_counter.cpp replaces the global allocation functions.
+std::size_t allocationCount();
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "alloc_counter.h"
+
+// Minimal benchmark harness: runs an operation in growing batches until
+// a minimum wall time is reached, then reports ns/op and allocations/op.
+// Results are printed as a single JSON document so runs can be compared
+// between releases.
+class BenchRunner {
+public:
+    struct Result {
+        std::string name;
+        std::size_t clients;
+        unsigned long long iterations;
+        double nsPerOp;
+        double allocsPerOp;
+    };
+
+    BenchRunner(int argc, char** argv) {
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--quick") == 0) {
+                m_Quick = true;
+            }
+        }
+    }
+
+    // --quick keeps the run short enough for a smoke test
+    bool quick() const { return m_Quick; }
+
+    // `op` is called with a running operation index
+    template<class Op>
+    void run(const char* name, std::size_t clients, Op op) {
+        const std::chrono::nanoseconds minTime = m_Quick ? std::chrono::milliseconds(1) : std::chrono::milliseconds(200);
+        unsigned long long batch = 1;
+        unsigned long long index = 0;
+        for (;;) {
+            const auto allocsBefore = allocationCount();
+            const auto start = std::chrono::steady_clock::now();
+            for (unsigned long long i = 0; i < batch; ++i) {
+                op(index++);
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            const auto allocs = allocationCount() - allocsBefore;
+            if (elapsed >= minTime || batch >= (1ULL << 40)) {
+                const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+                m_Results.push_back(Result{name, clients, batch, ns / batch, static_cast<double>(allocs) / batch});
+                return;
+            }
+            batch *= 2;
+        }
+    }
+
+    void print(const char* suite, FILE* out = stdout) const {
+        std::fprintf(out, "{\n  \"suite\": \"%s\",\n  \"results\": [\n", suite);
+        for (std::size_t i = 0; i < m_Results.size(); ++i) {
+            const Result& r = m_Results[i];
+            std::fprintf(out, "    {\"name\": \"%s\", \"clients\": %zu, \"iterations\": %llu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f}%s\n",
+                r.name.c_str(), r.clients, r.iterations, r.nsPerOp, r.allocsPerOp, i + 1 < m_Results.size() ? "," : "");
+        }
+        std::fprintf(out, "  ]\n}\n");
+    }
+
+private:
+    bool m_Quick = false;
+    std::vector<Result> m_Results;
+};
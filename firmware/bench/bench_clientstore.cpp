@@ -0,0 +1,183 @@
+// Contention between the thread applying packets and threads reading the client
+// table: one writer applies a status change and publishes the clients after each,
+// while 8 readers iterate the latest clients in a loop. Compares ClientStore with
+// a table copy behind a mutex, and reports the writer's updates per second, its
+// slowest publish, and the reads per second of all readers together.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "host/clientstore.h"
+
+namespace {
+
+constexpr size_t CLIENTS = 1000;
+constexpr size_t READERS = 8;
+
+class NullDevice : public I_Device {
+public:
+    virtual void log(StringView) override {}
+    virtual bool logEnabled() const override { return false; }
+    virtual void setMicrophoneLeds(Color) override {}
+    virtual void setWebcamLeds(Color) override {}
+    virtual void displayNumber(int) override {}
+};
+
+struct Result {
+    const char* name;
+    size_t readers;
+    size_t updates;
+    size_t reads;
+    double seconds;
+    double maxPublish_us;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The same client table as ClientStore, guarded by a mutex
+class LockedClients {
+    std::mutex m_Mutex;
+    ClientSnapshot m_Snapshot;
+
+public:
+    void publish(Timestamp now, const Firmware& firmware) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        ++m_Snapshot.version;
+        m_Snapshot.taken = now;
+        m_Snapshot.clients.clear();
+        m_Snapshot.microphones = 0;
+        m_Snapshot.webcams = 0;
+        firmware.forEachClient([&](const ClientStatus& client) {
+            m_Snapshot.clients.push_back(client);
+            m_Snapshot.microphones += client.microphone;
+            m_Snapshot.webcams += client.webcam;
+        });
+    }
+
+    template<class Fn>
+    void read(Fn fn) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        fn(static_cast<const ClientSnapshot&>(m_Snapshot));
+    }
+};
+
+// What a dashboard would do with the clients
+size_t countMicrophones(const ClientSnapshot& snapshot) {
+    size_t microphones = 0;
+    for (const ClientStatus& client : snapshot.clients) {
+        microphones += client.microphone;
+    }
+    return microphones;
+}
+
+// `publish` hands the firmware's clients to the readers, `read` reads them on the
+// reader thread with the given index and returns what countMicrophones() found.
+// The counts go to `checksum`, so that the reads can't be optimized away.
+template<class Publish, class Read>
+Result run(const char* name, size_t readers, double duration, std::atomic<size_t>& checksum, Publish publish, Read read) {
+    NullDevice device;
+    std::unique_ptr<Firmware> firmware = make_unique<Firmware>(device);
+    std::vector<std::string> packets;
+    for (size_t i = 0; i < 2 * CLIENTS; ++i) {
+        packets.push_back(fmt(R"({"version":1,"webcam":false,"microphone":%s,"senderId":"%08zx-b3eb-4664-a895-e824260d9050"})",
+            i < CLIENTS ? "true" : "false", i % CLIENTS));
+    }
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        firmware->udpReceived(0, packets[i]);
+    }
+    publish(0, *firmware);
+
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> reads(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < readers; ++i) {
+        threads.emplace_back([&, i] {
+            size_t count = 0;
+            size_t microphones = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                microphones += read(i);
+                ++count;
+            }
+            reads += count;
+            checksum += microphones;
+        });
+    }
+
+    size_t updates = 0;
+    double maxPublish = 0;
+    const Clock::time_point start = Clock::now();
+    double elapsed = 0;
+    for (; elapsed < duration; ++updates) {
+        // Flips one client's microphone per update
+        const Timestamp now = static_cast<Timestamp>(updates);
+        firmware->udpReceived(now, packets[(updates + CLIENTS) % (2 * CLIENTS)]);
+        const Clock::time_point before = Clock::now();
+        publish(now, *firmware);
+        const double publishSeconds = secondsSince(before);
+        maxPublish = publishSeconds > maxPublish ? publishSeconds : maxPublish;
+        elapsed = secondsSince(start);
+    }
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return Result{name, readers, updates, reads, elapsed, maxPublish * 1e6};
+}
+
+void print(const std::vector<Result>& results) {
+    std::printf("{\n  \"suite\": \"bench_clientstore\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::printf("    {\"name\": \"%s\", \"clients\": %zu, \"readers\": %zu, \"updates_per_s\": %.0f, \"max_publish_us\": %.1f, \"reads_per_s\": %.0f}%s\n",
+            r.name, CLIENTS, r.readers, r.updates / r.seconds, r.maxPublish_us, r.reads / r.seconds, i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+    const bool quick = argc > 1 && !std::strcmp(argv[1], "--quick");
+    const double duration = quick ? 0.05 : 2.0;
+    std::vector<Result> results;
+    std::atomic<size_t> checksum(0);
+
+    for (size_t readers : { size_t(0), READERS }) {
+        ClientStore<READERS> store;
+        std::vector<std::unique_ptr<ClientStore<READERS>::Reader>> handles;
+        for (size_t i = 0; i < readers; ++i) {
+            handles.push_back(make_unique<ClientStore<READERS>::Reader>(store));
+        }
+        results.push_back(run(readers ? "client store, 8 readers" : "client store, no readers", readers, duration, checksum,
+            [&](Timestamp now, const Firmware& firmware) { store.publish(now, firmware); },
+            [&](size_t reader) {
+                size_t microphones = 0;
+                handles[reader]->read([&](const ClientSnapshot& snapshot) { microphones = countMicrophones(snapshot); });
+                return microphones;
+            }));
+    }
+    {
+        std::unique_ptr<LockedClients> locked = make_unique<LockedClients>();
+        results.push_back(run("mutex, 8 readers", READERS, duration, checksum,
+            [&](Timestamp now, const Firmware& firmware) { locked->publish(now, firmware); },
+            [&](size_t) {
+                size_t microphones = 0;
+                locked->read([&](const ClientSnapshot& snapshot) { microphones = countMicrophones(snapshot); });
+                return microphones;
+            }));
+    }
+
+    print(results);
+    std::fprintf(stderr, "bench_clientstore: checksum %zu\n", checksum.load());
+    return 0;
+}
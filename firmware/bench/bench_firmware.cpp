@@ -0,0 +1,138 @@
+#include "bench.h"
+
+#include "lib_firmware.h"
+
+namespace {
+
+class NullDevice : public I_Device {
+public:
+    virtual void log(StringView) override {}
+    virtual bool logEnabled() const override { return false; }
+    virtual void setMicrophoneLeds(Color) override {}
+    virtual void setWebcamLeds(Color) override {}
+    virtual void displayNumber(int) override {}
+};
+
+std::string senderIdFor(std::size_t client) {
+    return fmt("%08zx-b3eb-4664-a895-e824260d9050", client);
+}
+
+// every client sends from its own address on the LAN
+Endpoint endpointFor(std::size_t client) {
+    return Endpoint(0x0a000000 + static_cast<uint32_t>(client), 50000);
+}
+
+std::string packetFor(std::size_t client, bool microphone, bool webcam) {
+    return fmt(R"({"version":1,"webcam":%s,"microphone":%s,"senderId":"%s"})",
+        webcam ? "true" : "false", microphone ? "true" : "false", senderIdFor(client).c_str());
+}
+
+void benchClients(BenchRunner& runner, std::size_t clients) {
+    NullDevice device;
+    std::unique_ptr<I_Firmware> firmware = make_unique<Firmware>(device);
+    const Timestamp now = 1000;
+
+    std::vector<std::string> packets;
+    packets.reserve(clients);
+    for (std::size_t i = 0; i < clients; ++i) {
+        packets.push_back(packetFor(i, i % 3 == 0, i % 5 == 0));
+        firmware->udpReceived(now, endpointFor(i), packets.back());
+    }
+
+    // steady state: every packet is a heartbeat from an already known sender
+    runner.run("udpReceived", clients, [&](unsigned long long i) {
+        firmware->udpReceived(now, endpointFor(i % clients), packets[i % clients]);
+    });
+    // every packet toggles its sender's microphone, so none can skip parsing
+    std::vector<std::string> toggled;
+    toggled.reserve(clients);
+    for (std::size_t i = 0; i < clients; ++i) {
+        toggled.push_back(packetFor(i, i % 3 != 0, i % 5 == 0));
+    }
+    runner.run("udpReceived changed", clients, [&](unsigned long long i) {
+        const std::size_t client = i % clients;
+        firmware->udpReceived(now, endpointFor(client), (i / clients) % 2 ? packets[client] : toggled[client]);
+    });
+    // a backlog after a stall: every sender repeated its status several times
+    const std::size_t repeats = 4;
+    const std::size_t batchSize = 16;
+    std::vector<Datagram> backlog;
+    for (std::size_t i = 0; i < batchSize; ++i) {
+        const std::size_t client = (i / repeats) % clients;
+        backlog.push_back(Datagram{packets[client], endpointFor(client)});
+    }
+    runner.run("udpReceivedBatch", clients, [&](unsigned long long) {
+        firmware->udpReceivedBatch(now, Span<const Datagram>(backlog.data(), backlog.size()));
+    });
+    // a relay forwarding 14 senders in one frame
+    StatusMessage entries[StatusFrame::MAX_BATCH_ENTRIES];
+    for (std::size_t i = 0; i < StatusFrame::MAX_BATCH_ENTRIES; ++i) {
+        entries[i].senderUuid = SenderKey::fromSenderId(senderIdFor(i % clients));
+        entries[i].microphone = true;
+    }
+    std::string relayed;
+    appendBatchFrame(relayed, Span<const StatusMessage>(entries, StatusFrame::MAX_BATCH_ENTRIES));
+    runner.run("udpReceived batch frame", clients, [&](unsigned long long) {
+        firmware->udpReceived(now, endpointFor(0), relayed);
+    });
+    // nobody times out, so this measures the cost of checking
+    runner.run("loopStarted", clients, [&](unsigned long long) {
+        firmware->loopStarted(now);
+    });
+    runner.run("loopEnded", clients, [&](unsigned long long) {
+        firmware->loopEnded(now);
+    });
+}
+
+// the status parser alone, against the general ArduinoJson path it replaced
+void benchParser(BenchRunner& runner) {
+    const std::string minified = packetFor(7, true, false);
+    const std::string spaced = fmt(R"({ "version": 1, "webcam": false, "microphone": true, "senderId": "%s" })", senderIdFor(7).c_str());
+    bool sink = false;
+
+    runner.run("StatusParser minified", 1, [&](unsigned long long) {
+        StatusParser parser;
+        StatusMessage message;
+        sink ^= parser.parse(minified, message) == nullptr && message.microphone;
+    });
+    runner.run("StatusParser fallback", 1, [&](unsigned long long) {
+        StatusParser parser;
+        StatusMessage message;
+        sink ^= parser.parse(spaced, message) == nullptr && message.microphone;
+    });
+    // the same map as `minified`, as MessagePack
+    const std::string msgPack = "\x84\xa7version\x01\xa6webcam\xc2\xaamicrophone\xc3\xa8senderId\xd9\x24" + senderIdFor(7);
+    runner.run("StatusParser msgpack", 1, [&](unsigned long long) {
+        StatusParser parser;
+        StatusMessage message;
+        sink ^= parser.parse(msgPack, message) == nullptr && message.microphone;
+    });
+    const std::string frame = std::string("\xc1\x02\x01", 3) + std::string(16, '\x5a');
+    runner.run("StatusParser frame", 1, [&](unsigned long long) {
+        StatusMessage message;
+        sink ^= StatusParser::decodeFrame(frame, message) == nullptr && message.microphone;
+    });
+    runner.run("ArduinoJson document", 1, [&](unsigned long long) {
+        StaticJsonDocument<256> doc;
+        if (!deserializeJson(doc, minified.data(), minified.size())) {
+            sink ^= doc["senderId"].as<const char*>() != nullptr && doc["microphone"].as<bool>()
+                && doc["webcam"].as<bool>() && doc["version"].as<int>() == 1;
+        }
+    });
+    if (sink) {
+        std::fputs("", stdout);
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const std::size_t maxClients = runner.quick() ? 100 : 100000;
+    for (std::size_t clients = 1; clients <= maxClients; clients *= 10) {
+        benchClients(runner, clients);
+    }
+    benchParser(runner);
+    runner.print("bench_firmware");
+    return 0;
+}
@@ -0,0 +1,274 @@
+// Compares the host daemon's receive backends, its network thread and its
+// sharded mode: a sender thread floods a loopback socket with heartbeats while
+// HostLoop feeds them to Firmware, as in checkmeet_hostd. Reports the received packets per second, and
+// the CPU time and syscalls the receiving side spent per packet.
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ctime>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "host/hostloop.h"
+#include "host/networkthread.h"
+#include "host/recvmmsgtransport.h"
+#include "host/shardedhost.h"
+#include "host/udpsocket.h"
+#include "host/uringtransport.h"
+
+namespace {
+
+constexpr uint32_t LOOPBACK = 0x7f000001;
+constexpr size_t CLIENTS = 1000;
+constexpr size_t SEND_BATCH = 64;
+// Source ports, for SO_REUSEPORT to spread
+constexpr size_t SOURCES = 16;
+// The same as checkmeet_hostd
+constexpr size_t RECV_BATCH = 64;
+constexpr size_t LOOP_BUDGET = 1024;
+constexpr size_t URING_BUFFERS = 1024;
+constexpr size_t HANDOFF_SLOTS = 4096;
+
+class NullDevice : public I_Device {
+public:
+    virtual void log(StringView) override {}
+    virtual bool logEnabled() const override { return false; }
+    virtual void setMicrophoneLeds(Color) override {}
+    virtual void setWebcamLeds(Color) override {}
+    virtual void displayNumber(int) override {}
+};
+
+struct Result {
+    const char* name;
+    size_t sent;
+    size_t received;
+    double seconds;
+    double cpuSeconds;
+    size_t syscalls;
+};
+
+double cpuSeconds(clockid_t clock) {
+    timespec now;
+    clock_gettime(clock, &now);
+    return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) / 1e9;
+}
+
+double wallSeconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) / 1e9;
+}
+
+struct Flood {
+    size_t sent = 0;
+    double cpuSeconds = 0;
+};
+
+// Sends the clients' heartbeats round robin with sendmmsg() until stopped
+Flood flood(uint16_t port, const std::atomic<bool>& stop) {
+    Flood result;
+    int senders[SOURCES];
+    for (int& sender : senders) {
+        sender = openUdpSocket(LOOPBACK, 0);
+        if (sender < 0) {
+            return result;
+        }
+    }
+    std::vector<std::string> packets;
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        packets.push_back(fmt(R"({"version":1,"webcam":%s,"microphone":%s,"senderId":"%08zx-b3eb-4664-a895-e824260d9050"})",
+            i % 5 == 0 ? "true" : "false", i % 3 == 0 ? "true" : "false", i));
+    }
+    sockaddr_in destination = {};
+    destination.sin_family = AF_INET;
+    destination.sin_addr.s_addr = htonl(LOOPBACK);
+    destination.sin_port = htons(port);
+    iovec vectors[SEND_BATCH];
+    mmsghdr headers[SEND_BATCH];
+    std::memset(headers, 0, sizeof(headers));
+
+    const double cpuStart = cpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+    for (size_t round = 0; !stop.load(std::memory_order_relaxed); ++round) {
+        for (size_t i = 0; i < SEND_BATCH; ++i) {
+            std::string& packet = packets[(result.sent + i) % CLIENTS];
+            vectors[i].iov_base = &packet[0];
+            vectors[i].iov_len = packet.size();
+            headers[i].msg_hdr.msg_iov = &vectors[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+            headers[i].msg_hdr.msg_name = &destination;
+            headers[i].msg_hdr.msg_namelen = sizeof(destination);
+        }
+        // The socket is non-blocking, a full receive buffer just drops the batch
+        const int count = sendmmsg(senders[round % SOURCES], headers, SEND_BATCH, 0);
+        if (count > 0) {
+            result.sent += static_cast<size_t>(count);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    result.cpuSeconds = cpuSeconds(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    for (int sender : senders) {
+        close(sender);
+    }
+    return result;
+}
+
+// The receiving side's CPU time is the process' minus the sender's. With a
+// `network` thread, that thread reads `transport` and hands over to the loop.
+bool run(const char* name, I_HostTransport& transport, uint16_t port, double duration, Result& result,
+        NetworkThread<RECV_BATCH, HANDOFF_SLOTS>* network = nullptr) {
+    NullDevice device;
+    std::unique_ptr<Firmware> firmware = make_unique<Firmware>(device);
+    I_HostTransport& received = network ? static_cast<I_HostTransport&>(*network) : transport;
+    HostLoop<RECV_BATCH> loop(*firmware, received, -1, LOOP_BUDGET);
+    if (!loop.ok()) {
+        return false;
+    }
+    std::atomic<bool> stop(false);
+    Flood sender;
+    const size_t syscallsBefore = received.syscalls();
+    const double cpuStart = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID);
+    if (network) {
+        network->start();
+    }
+    std::thread thread([&] { sender = flood(port, stop); });
+
+    const double start = wallSeconds();
+    double now = start;
+    while (now - start < duration && loop.runOnce(10)) {
+        now = wallSeconds();
+    }
+    const size_t datagrams = loop.datagrams();
+    stop = true;
+    thread.join();
+    if (network) {
+        network->stop();
+    }
+    const size_t syscalls = received.syscalls() - syscallsBefore;
+    result = Result{name, sender.sent, datagrams, now - start, cpuSeconds(CLOCK_PROCESS_CPUTIME_ID) - cpuStart - sender.cpuSeconds, syscalls};
+    return !received.lastError();
+}
+
+bool runSharded(const char* name, size_t shards, double duration, Result& result) {
+    ShardedHost<RECV_BATCH> host(shards, LOOPBACK, 0, DEFAULT_CLIENT_TIMEOUT_MS, nullptr, LOOP_BUDGET, [](int socket) {
+        return std::unique_ptr<I_HostTransport>(new RecvmmsgTransport<RECV_BATCH>(socket));
+    });
+    if (!host.ok()) {
+        return false;
+    }
+    NullDevice device;
+    std::atomic<bool> stop(false);
+    Flood sender;
+    const double cpuStart = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID);
+    host.start();
+    std::thread thread([&] { sender = flood(host.port(), stop); });
+
+    const double start = wallSeconds();
+    double now = start;
+    pollfd merge = { host.mergeFd(), POLLIN, 0 };
+    while (now - start < duration && !host.failed()) {
+        if (poll(&merge, 1, 10) == 1) {
+            host.merge(device);
+        }
+        now = wallSeconds();
+    }
+    stop = true;
+    thread.join();
+    host.stop();
+    const ShardedStats stats = host.stats();
+    result = Result{name, sender.sent, stats.datagrams, now - start, cpuSeconds(CLOCK_PROCESS_CPUTIME_ID) - cpuStart - sender.cpuSeconds, stats.syscalls};
+    return !host.failed();
+}
+
+void print(const std::vector<Result>& results) {
+    std::printf("{\n  \"suite\": \"bench_transport\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        const double received = r.received ? static_cast<double>(r.received) : 1.0;
+        std::printf("    {\"name\": \"%s\", \"clients\": %zu, \"sent\": %zu, \"received\": %zu, \"packets_per_s\": %.0f, \"cpu_ns_per_packet\": %.2f, \"syscalls_per_packet\": %.4f}%s\n",
+            r.name, CLIENTS, r.sent, r.received, r.received / r.seconds, r.cpuSeconds * 1e9 / received,
+            r.syscalls / received, i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+    const bool quick = argc > 1 && !std::strcmp(argv[1], "--quick");
+    const double duration = quick ? 0.05 : 2.0;
+    std::vector<Result> results;
+
+    const int epollSocket = openUdpSocket(LOOPBACK, 0);
+    if (epollSocket < 0) {
+        std::perror("bench_transport: cannot open UDP socket");
+        return 1;
+    }
+    {
+        std::unique_ptr<RecvmmsgTransport<RECV_BATCH>> transport = make_unique<RecvmmsgTransport<RECV_BATCH>>(epollSocket);
+        Result result;
+        if (!run("epoll recvmmsg", *transport, boundPort(epollSocket), duration, result)) {
+            std::fprintf(stderr, "bench_transport: epoll backend failed\n");
+            return 1;
+        }
+        results.push_back(result);
+    }
+    close(epollSocket);
+
+    // The same, with the receiving on a network thread
+    const int handoffSocket = openUdpSocket(LOOPBACK, 0);
+    if (handoffSocket < 0) {
+        std::perror("bench_transport: cannot open UDP socket");
+        return 1;
+    }
+    {
+        std::unique_ptr<RecvmmsgTransport<RECV_BATCH>> transport = make_unique<RecvmmsgTransport<RECV_BATCH>>(handoffSocket);
+        std::unique_ptr<NetworkThread<RECV_BATCH, HANDOFF_SLOTS>> network = make_unique<NetworkThread<RECV_BATCH, HANDOFF_SLOTS>>(*transport);
+        Result result;
+        if (!network->ok() || !run("epoll recvmmsg, network thread", *transport, boundPort(handoffSocket), duration, result, network.get())) {
+            std::fprintf(stderr, "bench_transport: network thread failed\n");
+            return 1;
+        }
+        results.push_back(result);
+    }
+    close(handoffSocket);
+
+    const int uringSocket = openUdpSocket(LOOPBACK, 0);
+    if (uringSocket < 0) {
+        std::perror("bench_transport: cannot open UDP socket");
+        return 1;
+    }
+    {
+        std::unique_ptr<UringTransport<URING_BUFFERS>> transport = make_unique<UringTransport<URING_BUFFERS>>(uringSocket);
+        Result result;
+        if (!transport->ok()) {
+            std::fprintf(stderr, "bench_transport: io_uring is not available: %s\n", std::strerror(transport->error()));
+        } else if (!run("io_uring multishot", *transport, boundPort(uringSocket), duration, result)) {
+            std::fprintf(stderr, "bench_transport: io_uring backend failed\n");
+            return 1;
+        } else {
+            results.push_back(result);
+        }
+    }
+    close(uringSocket);
+
+    // Scaling of the sharded mode, with the epoll backend
+    const char* const shardedNames[] = { "sharded 1 thread", "sharded 2 threads", "sharded 4 threads" };
+    for (size_t i = quick ? 1 : 0; i < (quick ? 2 : 3); ++i) {
+        Result result;
+        if (!runSharded(shardedNames[i], size_t(1) << i, duration, result)) {
+            std::fprintf(stderr, "bench_transport: %s failed\n", shardedNames[i]);
+            return 1;
+        }
+        results.push_back(result);
+    }
+
+    print(results);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "catch.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+#include "clienttable.h"
+
+TEST_CASE( "SenderKey parses UUIDs" ) {
+    SenderKey key;
+    REQUIRE( SenderKey::parseUuid("51000b59-b3eb-4664-a895-e824260d9050"_sv, key) );
+    REQUIRE( key.hi == 0x51000b59b3eb4664ULL );
+    REQUIRE( key.lo == 0xa895e824260d9050ULL );
+
+    REQUIRE( SenderKey::fromSenderId("51000B59-B3EB-4664-A895-E824260D9050"_sv) == key );
+
+    REQUIRE_FALSE( SenderKey::parseUuid("51000b59-b3eb-4664-a895-e824260d905"_sv, key) );
+    REQUIRE_FALSE( SenderKey::parseUuid("51000b59-b3eb-4664-a895-e824260d905g"_sv, key) );
+    REQUIRE_FALSE( SenderKey::parseUuid("51000b59b-3eb-4664-a895-e824260d9050"_sv, key) );
+}
+
+TEST_CASE( "SenderKey hashes other sender IDs" ) {
+    const auto empty = SenderKey::fromSenderId(StringView());
+    const auto kitchen = SenderKey::fromSenderId("kitchen"_sv);
+    const auto livingRoom = SenderKey::fromSenderId("living room"_sv);
+
+    REQUIRE( empty == SenderKey::fromSenderId(""_sv) );
+    REQUIRE( kitchen == SenderKey::fromSenderId("kitchen"_sv) );
+    REQUIRE( empty != kitchen );
+    REQUIRE( kitchen != livingRoom );
+    REQUIRE( kitchen != SenderKey::fromSenderId("51000b59-b3eb-4664-a895-e824260d9050"_sv) );
+}
+
+namespace {
+    SenderKey keyFor(uint64_t n) {
+        SenderKey key;
+        key.hi = n;
+        key.lo = ~n;
+        return key;
+    }
+}
+
+TEST_CASE( "ClientTable stores values by key" ) {
+    using Table = ClientTable<int, 4>;
+    auto table = make_unique<Table>();
+    REQUIRE( table->empty() );
+
+    const auto a = table->insert(keyFor(1));
+    const auto b = table->insert(keyFor(2));
+    REQUIRE( a != Table::NO_SLOT );
+    REQUIRE( b != Table::NO_SLOT );
+    (*table)[a] = 10;
+    (*table)[b] = 20;
+
+    REQUIRE( table->size() == 2 );
+    REQUIRE( table->find(keyFor(1)) == a );
+    REQUIRE( table->find(keyFor(2)) == b );
+    REQUIRE( table->find(keyFor(3)) == Table::NO_SLOT );
+    REQUIRE( table->keyOf(a) == keyFor(1) );
+    REQUIRE( (*table)[table->find(keyFor(2))] == 20 );
+
+    SECTION("full table rejects new keys") {
+        REQUIRE( table->insert(keyFor(3)) != Table::NO_SLOT );
+        REQUIRE( table->insert(keyFor(4)) != Table::NO_SLOT );
+        REQUIRE( table->insert(keyFor(5)) == Table::NO_SLOT );
+        REQUIRE( table->size() == 4 );
+    }
+
+    SECTION("erased slots are reused") {
+        table->erase(a);
+        REQUIRE( table->size() == 1 );
+        REQUIRE( table->find(keyFor(1)) == Table::NO_SLOT );
+        REQUIRE( table->find(keyFor(2)) == b );
+
+        const auto c = table->insert(keyFor(3));
+        REQUIRE( c == a );
+        REQUIRE( (*table)[c] == 0 );
+    }
+}
+
+TEST_CASE( "ClientTable keeps slots in touch order" ) {
+    using Table = ClientTable<int, 8>;
+    auto table = make_unique<Table>();
+    REQUIRE( table->oldest() == Table::NO_SLOT );
+
+    const auto a = table->insert(keyFor(1));
+    const auto b = table->insert(keyFor(2));
+    const auto c = table->insert(keyFor(3));
+    const auto order = [&]() {
+        std::vector<Table::SlotId> result;
+        for (auto id = table->oldest(); id != Table::NO_SLOT; id = table->newer(id)) {
+            result.push_back(id);
+        }
+        return result;
+    };
+    REQUIRE( order() == std::vector<Table::SlotId>{ a, b, c } );
+
+    table->touch(a);
+    REQUIRE( order() == std::vector<Table::SlotId>{ b, c, a } );
+
+    table->touch(c);
+    REQUIRE( order() == std::vector<Table::SlotId>{ b, a, c } );
+
+    table->touch(c);
+    REQUIRE( order() == std::vector<Table::SlotId>{ b, a, c } );
+
+    table->erase(a);
+    REQUIRE( order() == std::vector<Table::SlotId>{ b, c } );
+
+    table->erase(b);
+    REQUIRE( order() == std::vector<Table::SlotId>{ c } );
+
+    const auto d = table->insert(keyFor(4));
+    REQUIRE( order() == std::vector<Table::SlotId>{ c, d } );
+
+    table->erase(d);
+    table->erase(c);
+    REQUIRE( order().empty() );
+}
+
+TEST_CASE( "FlatMap matches std::unordered_map under random operations" ) {
+    struct CollidingKey {
+        uint32_t n = 0;
+        uint32_t hash() const { return n % 7; } // forces long probe sequences
+        bool operator==(const CollidingKey& other) const { return n == other.n; }
+    };
+    auto map = make_unique<FlatMap<CollidingKey, uint32_t, 64>>();
+    std::unordered_map<uint32_t, uint32_t> reference;
+
+    uint32_t state = 12345;
+    const auto next = [&state]() { state = state * 1103515245 + 12345; return (state >> 16) & 0x7fff; };
+    for (int i = 0; i < 20000; ++i) {
+        CollidingKey key;
+        key.n = next() % 100;
+        if (next() % 2) {
+            const bool inserted = map->insert(key, static_cast<uint32_t>(i));
+            if (reference.count(key.n) || reference.size() + 1 < map->capacity()) {
+                REQUIRE( inserted );
+                reference[key.n] = static_cast<uint32_t>(i);
+            } else {
+                REQUIRE_FALSE( inserted );
+            }
+        } else {
+            REQUIRE( map->erase(key) == (reference.erase(key.n) == 1) );
+        }
+        REQUIRE( map->size() == reference.size() );
+    }
+    for (uint32_t n = 0; n < 100; ++n) {
+        CollidingKey key;
+        key.n = n;
+        const auto found = map->find(key);
+        const auto expected = reference.find(n);
+        REQUIRE( (found != nullptr) == (expected != reference.end()) );
+        if (found) {
+            REQUIRE( *found == expected->second );
+        }
+    }
+}
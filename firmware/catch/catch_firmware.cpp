@@ -1,6 +1,10 @@
 #include "catch.hpp"
 
+#include <deque>
+#include <vector>
+
 #include "lib_firmware.h"
+#include "../bench/alloc_counter.h"
 
 TEST_CASE( "rnd() returns 4" ) {
     REQUIRE( rnd() == 4 );
@@ -12,19 +16,41 @@ public:
     Color microphone = Color::Standby;
     Color webcam = Color::Standby;
     int display = 0;
+    bool logging = true;
+    int commits = 0; // number of physical LED refreshes
+    bool inFrame = false;
+    int logs = 0;
 
     virtual void log(StringView message) override {
+        ++logs;
         UNSCOPED_INFO("Log: " << std::string(message.data(), message.size()));
     }
 
+    virtual bool logEnabled() const override {
+        return logging;
+    }
+
+    virtual void beginLedFrame() override {
+        REQUIRE_FALSE(inFrame);
+        inFrame = true;
+    }
+
     virtual void setMicrophoneLeds(Color color) override {
+        REQUIRE(inFrame);
         microphone = color;
     }
 
     virtual void setWebcamLeds(Color color) override {
+        REQUIRE(inFrame);
         webcam = color;
     }
 
+    virtual void commitLedFrame() override {
+        REQUIRE(inFrame);
+        inFrame = false;
+        ++commits;
+    }
+
     virtual void displayNumber(int number) override {
         display = number;
     }
@@ -297,3 +323,513 @@ TEST_CASE("Firmware puts the LEDs in standby when no client is active") {
     REQUIRE(device.microphone == Color::Standby);
     REQUIRE(device.webcam == Color::Standby);
 }
+
+TEST_CASE("Firmware does not allocate for packets from known senders") {
+    FakeDevice device;
+    device.logging = false;
+    std::unique_ptr<I_Firmware> firmware = make_unique<Firmware>(device);
+
+    firmware->loopStarted(0);
+    firmware->udpReceived(0, R"({"version":1,"webcam":false,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware->udpReceived(0, R"({"version":1,"webcam":false,"microphone":false,"senderId":"9a11f5c3-bb0f-441b-9825-9e7891bfb78c"})");
+    firmware->udpReceived(0, R"({"version":1,"webcam":false,"microphone":false})");
+    firmware->loopEnded(0);
+
+    const auto allocationsBefore = allocationCount();
+    for (Timestamp ts = 1000; ts < 10000; ts += 1000) {
+        firmware->loopStarted(ts);
+        firmware->udpReceived(ts, R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+        firmware->udpReceived(ts, R"({"version":1,"webcam":false,"microphone":true,"senderId":"9a11f5c3-bb0f-441b-9825-9e7891bfb78c"})");
+        firmware->udpReceived(ts, R"({"version":1,"webcam":false,"microphone":false})");
+        firmware->loopEnded(ts);
+    }
+    const auto allocations = allocationCount() - allocationsBefore;
+
+    REQUIRE(allocations == 0);
+    REQUIRE(device.microphone == Color::On);
+    REQUIRE(device.webcam == Color::On);
+    REQUIRE(device.display == 3);
+}
+
+TEST_CASE("Firmware expires clients across the millis() wrap-around") {
+    FakeDevice device;
+    const Timestamp timeout = 10000;
+    std::unique_ptr<I_Firmware> firmware = make_unique<Firmware>(device, timeout);
+    const Timestamp start = 0xffffffff - 5000;
+
+    INFO("client #1 init just before the wrap-around");
+    firmware->loopStarted(start);
+    firmware->udpReceived(start, R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware->loopEnded(start);
+
+    INFO("client #2 init just after the wrap-around");
+    firmware->loopStarted(start + 6000);
+    firmware->udpReceived(start + 6000, R"({"version":1,"webcam":false,"microphone":true,"senderId":"9a11f5c3-bb0f-441b-9825-9e7891bfb78c"})");
+    firmware->loopEnded(start + 6000);
+    REQUIRE(device.microphone == Color::On);
+    REQUIRE(device.webcam == Color::On);
+    REQUIRE(device.display == 2);
+
+    INFO("client #1 still within timeout limit");
+    firmware->loopStarted(start + timeout);
+    firmware->loopEnded(start + timeout);
+    REQUIRE(device.webcam == Color::On);
+    REQUIRE(device.display == 2);
+
+    INFO("client #1 exceeds timeout limit");
+    firmware->loopStarted(start + timeout + 1);
+    firmware->loopEnded(start + timeout + 1);
+    REQUIRE(device.microphone == Color::On);
+    REQUIRE(device.webcam == Color::Off);
+    REQUIRE(device.display == 1);
+
+    INFO("client #2 exceeds timeout limit");
+    firmware->loopStarted(start + 6000 + timeout + 1);
+    firmware->loopEnded(start + 6000 + timeout + 1);
+    REQUIRE(device.microphone == Color::Standby);
+    REQUIRE(device.webcam == Color::Standby);
+    REQUIRE(device.display == 0);
+}
+
+TEST_CASE("Firmware reports the next client timeout as deadline") {
+    FakeDevice device;
+    const Timestamp timeout = 10000;
+    std::unique_ptr<I_Firmware> firmware = make_unique<Firmware>(device, timeout);
+    Timestamp deadline = 0;
+
+    REQUIRE_FALSE(firmware->nextDeadline(deadline));
+
+    firmware->loopStarted(0);
+    firmware->udpReceived(0, R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware->loopEnded(0);
+    REQUIRE(firmware->nextDeadline(deadline));
+    REQUIRE(deadline == timeout + 1);
+
+    firmware->loopStarted(2000);
+    firmware->udpReceived(2000, R"({"version":1,"webcam":false,"microphone":true,"senderId":"9a11f5c3-bb0f-441b-9825-9e7891bfb78c"})");
+    firmware->loopEnded(2000);
+    REQUIRE(firmware->nextDeadline(deadline));
+    REQUIRE(deadline == timeout + 1);
+
+    SECTION("refreshing the oldest client moves the deadline") {
+        firmware->loopStarted(3000);
+        firmware->udpReceived(3000, R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+        firmware->loopEnded(3000);
+        REQUIRE(firmware->nextDeadline(deadline));
+        REQUIRE(deadline == 2000 + timeout + 1);
+    }
+
+    SECTION("clients expire exactly at the deadline") {
+        firmware->loopStarted(deadline - 1);
+        firmware->loopEnded(deadline - 1);
+        REQUIRE(device.webcam == Color::On);
+        REQUIRE(device.display == 2);
+
+        firmware->loopStarted(deadline);
+        firmware->loopEnded(deadline);
+        REQUIRE(device.webcam == Color::Off);
+        REQUIRE(device.display == 1);
+
+        REQUIRE(firmware->nextDeadline(deadline));
+        REQUIRE(deadline == 2000 + timeout + 1);
+
+        firmware->loopStarted(deadline - 1);
+        firmware->loopEnded(deadline - 1);
+        REQUIRE(device.microphone == Color::On);
+
+        firmware->loopStarted(deadline);
+        firmware->loopEnded(deadline);
+        REQUIRE(device.microphone == Color::Standby);
+        REQUIRE(device.display == 0);
+        REQUIRE_FALSE(firmware->nextDeadline(deadline));
+    }
+}
+
+TEST_CASE("Firmware refreshes the LEDs once per state change") {
+    FakeDevice device;
+    std::unique_ptr<I_Firmware> firmware = make_unique<Firmware>(device);
+    REQUIRE(device.microphone == Color::Initializing);
+    REQUIRE(device.commits == 1);
+
+    firmware->loopStarted(0);
+    firmware->loopEnded(0);
+    REQUIRE(device.microphone == Color::Standby);
+    REQUIRE(device.webcam == Color::Standby);
+    REQUIRE(device.commits == 2);
+
+    firmware->loopStarted(1);
+    firmware->udpReceived(1, R"({"version":1,"webcam":false,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware->loopEnded(1);
+    REQUIRE(device.commits == 3);
+
+    INFO("nothing changes");
+    for (Timestamp ts = 2; ts < 100; ++ts) {
+        firmware->loopStarted(ts);
+        firmware->udpReceived(ts, R"({"version":1,"webcam":false,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+        firmware->loopEnded(ts);
+    }
+    REQUIRE(device.commits == 3);
+
+    INFO("both indicators change in one frame");
+    firmware->loopStarted(100);
+    firmware->udpReceived(100, R"({"version":1,"webcam":true,"microphone":true,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware->loopEnded(100);
+    REQUIRE(device.microphone == Color::On);
+    REQUIRE(device.webcam == Color::On);
+    REQUIRE(device.commits == 4);
+
+    INFO("one indicator changes");
+    firmware->loopStarted(101);
+    firmware->udpReceived(101, R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware->loopEnded(101);
+    REQUIRE(device.microphone == Color::Off);
+    REQUIRE(device.webcam == Color::On);
+    REQUIRE(device.commits == 5);
+}
+
+namespace {
+
+class FakeTransport : public I_Transport {
+public:
+    std::deque<std::string> queue;
+    std::vector<std::string> delivered; // keeps the payloads of the last receive() alive
+    int calls = 0;
+
+    virtual size_t receive(Span<Datagram> batch) override {
+        ++calls;
+        delivered.clear();
+        while (delivered.size() < batch.size() && !queue.empty()) {
+            delivered.push_back(queue.front());
+            queue.pop_front();
+        }
+        for (size_t i = 0; i < delivered.size(); ++i) {
+            batch.data()[i].payload = delivered[i];
+        }
+        return delivered.size();
+    }
+};
+
+}
+
+TEST_CASE("Firmware handles a batch of datagrams with one LED refresh") {
+    FakeDevice device;
+    std::unique_ptr<I_Firmware> firmware = make_unique<Firmware>(device);
+    FakeTransport transport;
+    transport.queue = {
+        R"({"version":1,"webcam":false,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})",
+        R"({"version":1,"webcam":false,"microphone":true,"senderId":"9a11f5c3-bb0f-441b-9825-9e7891bfb78c"})",
+        R"(not json)",
+        R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})",
+        R"({"version":1,"webcam":false,"microphone":false,"senderId":"c0ffee00-b3eb-4664-a895-e824260d9050"})",
+    };
+    const int commits = device.commits;
+
+    firmware->loopStarted(0);
+    REQUIRE(receiveDatagrams<8>(transport, *firmware, 0, 16) == 5);
+    firmware->loopEnded(0);
+
+    REQUIRE(device.microphone == Color::On);
+    REQUIRE(device.webcam == Color::On);
+    REQUIRE(device.display == 3);
+    INFO("Standby from loopStarted, then one frame for the whole batch");
+    REQUIRE(device.commits == commits + 2);
+    REQUIRE(transport.calls == 2);
+}
+
+TEST_CASE("receiveDatagrams() respects the budget") {
+    FakeDevice device;
+    std::unique_ptr<I_Firmware> firmware = make_unique<Firmware>(device);
+    FakeTransport transport;
+    for (int i = 0; i < 10; ++i) {
+        transport.queue.push_back(fmt(R"({"version":1,"webcam":false,"microphone":false,"senderId":"%08x-b3eb-4664-a895-e824260d9050"})", i));
+    }
+
+    REQUIRE(receiveDatagrams<4>(transport, *firmware, 0, 6) == 6);
+    REQUIRE(transport.calls == 2);
+    REQUIRE(transport.queue.size() == 4);
+    firmware->loopEnded(0);
+    REQUIRE(device.display == 6);
+
+    REQUIRE(receiveDatagrams<4>(transport, *firmware, 0, 6) == 4);
+    REQUIRE(transport.queue.empty());
+    firmware->loopEnded(0);
+    REQUIRE(device.display == 10);
+}
+
+TEST_CASE("Firmware applies only the newest packet of each sender in a batch") {
+    FakeDevice device;
+    Firmware firmware(device);
+    const std::string first = R"({"version":1,"webcam":false,"microphone":true,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})";
+    const std::string second = R"({"version":1,"webcam":true,"microphone":false,"senderId":"9a11f5c3-bb0f-441b-9825-9e7891bfb78c"})";
+    const std::string latest = R"({"version":1,"webcam":false,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})";
+    const Datagram batch[] = { {first, Endpoint()}, {second, Endpoint()}, {first, Endpoint()}, {latest, Endpoint()} };
+
+    firmware.udpReceivedBatch(0, Span<const Datagram>(batch, 4));
+    firmware.loopEnded(0);
+
+    REQUIRE(firmware.stats().supersededPackets == 2);
+    REQUIRE(device.display == 2);
+    REQUIRE(device.microphone == Color::Off);
+    REQUIRE(device.webcam == Color::On);
+
+    SECTION("Packets of different batches don't supersede each other") {
+        firmware.udpReceivedBatch(0, Span<const Datagram>(batch, 1));
+        REQUIRE(firmware.stats().supersededPackets == 2);
+        REQUIRE(device.microphone == Color::On);
+    }
+}
+
+TEST_CASE("Firmware skips parsing byte-identical heartbeats") {
+    FakeDevice device;
+    Firmware firmware(device, 30000);
+    const std::string heartbeat = R"({"version":1,"webcam":false,"microphone":true,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})";
+
+    firmware.udpReceived(0, heartbeat);
+    const int commits = device.commits;
+    const int logs = device.logs;
+
+    firmware.udpReceived(20000, heartbeat);
+    REQUIRE(firmware.stats().unchangedPackets == 1);
+    REQUIRE(device.logs == logs);
+    REQUIRE(device.commits == commits);
+
+    INFO("The heartbeat kept the client alive");
+    firmware.loopStarted(40000);
+    firmware.loopEnded(40000);
+    REQUIRE(device.display == 1);
+    REQUIRE(device.microphone == Color::On);
+
+    SECTION("A changed packet is parsed again") {
+        firmware.udpReceived(40000, R"({"version":1,"webcam":true,"microphone":true,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+        REQUIRE(device.webcam == Color::On);
+        firmware.udpReceived(40000, heartbeat);
+        REQUIRE(firmware.stats().unchangedPackets == 1);
+        REQUIRE(device.webcam == Color::Off);
+    }
+    SECTION("The fingerprint is forgotten with the client") {
+        firmware.loopStarted(60000);
+        firmware.loopEnded(60000);
+        REQUIRE(device.display == 0);
+        firmware.udpReceived(60000, heartbeat);
+        firmware.loopEnded(60000);
+        REQUIRE(firmware.stats().unchangedPackets == 1);
+        REQUIRE(device.display == 1);
+        REQUIRE(device.microphone == Color::On);
+    }
+    SECTION("Heartbeats in a batch are coalesced too") {
+        const Datagram batch[] = { {heartbeat, Endpoint()}, {heartbeat, Endpoint()} };
+        firmware.udpReceivedBatch(50000, Span<const Datagram>(batch, 2));
+        REQUIRE(firmware.stats().unchangedPackets == 2);
+        REQUIRE(firmware.stats().supersededPackets == 1);
+        firmware.loopStarted(70000);
+        firmware.loopEnded(70000);
+        REQUIRE(device.display == 1);
+    }
+}
+
+TEST_CASE("Firmware counts the packets it ignores with a full client table") {
+    FakeDevice device;
+    Firmware firmware(device, 30000);
+    for (int i = 0; i <= CHECKMEET_MAX_CLIENTS; ++i) {
+        firmware.udpReceived(0, fmt(R"({"version":1,"webcam":false,"microphone":%s,"senderId":"%08x-b3eb-4664-a895-e824260d9050"})",
+            i < CHECKMEET_MAX_CLIENTS ? "false" : "true", i));
+    }
+    firmware.loopEnded(0);
+    REQUIRE(device.display == CHECKMEET_MAX_CLIENTS);
+    REQUIRE(firmware.stats().rejectedPackets == 1);
+    REQUIRE(device.microphone == Color::Off);
+}
+
+TEST_CASE("Firmware identifies senders without senderId by their endpoint") {
+    FakeDevice device;
+    Firmware firmware(device, 30000);
+    const std::string microphoneOn = R"({"version":1,"webcam":false,"microphone":true})";
+    const std::string microphoneOff = R"({"version":1,"webcam":false,"microphone":false})";
+    const Endpoint first(0xc0a80002, 50000);
+    const Endpoint second(0xc0a80003, 50000);
+
+    firmware.udpReceived(0, first, microphoneOn);
+    firmware.udpReceived(0, second, microphoneOff);
+    firmware.loopEnded(0);
+    REQUIRE(device.display == 2);
+    REQUIRE(device.microphone == Color::On);
+
+    SECTION("Heartbeats are resolved through the endpoint") {
+        firmware.udpReceived(20000, first, microphoneOn);
+        REQUIRE(firmware.stats().unchangedPackets == 1);
+        firmware.loopStarted(40000);
+        firmware.loopEnded(40000);
+        REQUIRE(device.display == 1);
+        REQUIRE(device.microphone == Color::On);
+    }
+    SECTION("A sender's own change doesn't affect the other") {
+        firmware.udpReceived(0, first, microphoneOff);
+        firmware.loopEnded(0);
+        REQUIRE(device.display == 2);
+        REQUIRE(device.microphone == Color::Off);
+    }
+    SECTION("Without an endpoint they merge, as before") {
+        firmware.udpReceived(0, microphoneOff);
+        firmware.udpReceived(0, microphoneOn);
+        firmware.loopEnded(0);
+        REQUIRE(device.display == 3);
+    }
+}
+
+TEST_CASE("Firmware follows a sender that moves to another endpoint") {
+    FakeDevice device;
+    Firmware firmware(device, 30000);
+    const Endpoint before(0xc0a80002, 50000);
+    const Endpoint after(0xc0a80002, 50001);
+
+    firmware.udpReceived(0, before, R"({"version":1,"webcam":false,"microphone":true,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware.udpReceived(0, after, R"({"version":1,"webcam":true,"microphone":true,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware.loopEnded(0);
+    REQUIRE(device.display == 1);
+    REQUIRE(device.webcam == Color::On);
+
+    INFO("The old endpoint no longer belongs to the sender");
+    firmware.udpReceived(0, before, R"({"version":1,"webcam":false,"microphone":false})");
+    firmware.loopEnded(0);
+    REQUIRE(device.display == 2);
+}
+
+TEST_CASE("Firmware lists its clients in update order") {
+    FakeDevice device;
+    Firmware firmware(device, 30000);
+    const Endpoint source(0xc0a80002, 50000);
+
+    firmware.udpReceived(0, source, R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware.udpReceived(10, R"({"version":1,"webcam":false,"microphone":true,"senderId":"62000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware.udpReceived(20, source, R"({"version":1,"webcam":false,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+
+    std::vector<ClientStatus> clients;
+    firmware.forEachClient([&](const ClientStatus& client) { clients.push_back(client); });
+    REQUIRE(clients.size() == 2);
+    REQUIRE(clients[0].key == SenderKey::fromSenderId("62000b59-b3eb-4664-a895-e824260d9050"));
+    REQUIRE_FALSE(clients[0].source.known());
+    REQUIRE(clients[0].lastUpdate == 10);
+    REQUIRE(clients[0].microphone);
+    REQUIRE_FALSE(clients[0].webcam);
+    REQUIRE(clients[1].key == SenderKey::fromSenderId("51000b59-b3eb-4664-a895-e824260d9050"));
+    REQUIRE(clients[1].source == source);
+    REQUIRE(clients[1].lastUpdate == 20);
+    REQUIRE_FALSE(clients[1].microphone);
+    REQUIRE_FALSE(clients[1].webcam);
+}
+
+TEST_CASE("Firmware accepts binary v2 frames next to JSON") {
+    FakeDevice device;
+    Firmware firmware(device);
+    const std::string uuid("\x51\x00\x0b\x59\xb3\xeb\x46\x64\xa8\x95\xe8\x24\x26\x0d\x90\x50", 16);
+
+    firmware.udpReceived(0, R"({"version":1,"webcam":false,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware.udpReceived(0, std::string("\xc1\x02\x03", 3) + uuid);
+    firmware.loopEnded(0);
+
+    INFO("The same UUID is the same client in either protocol");
+    REQUIRE(device.display == 1);
+    REQUIRE(device.microphone == Color::On);
+    REQUIRE(device.webcam == Color::On);
+}
+
+TEST_CASE("Firmware skips parsing repeated v2 heartbeats") {
+    FakeDevice device;
+    Firmware firmware(device, 30000);
+    const std::string uuid("\x51\x00\x0b\x59\xb3\xeb\x46\x64\xa8\x95\xe8\x24\x26\x0d\x90\x50", 16);
+    // Microphone on, sequence number 7, which senders only advance on a change
+    const std::string heartbeat = std::string("\xc1\x02\x05", 3) + uuid + std::string("\x00\x00\x00\x07", 4);
+
+    firmware.udpReceived(0, heartbeat);
+    firmware.udpReceived(20000, heartbeat);
+    REQUIRE(firmware.stats().unchangedPackets == 1);
+
+    firmware.loopStarted(40000);
+    firmware.loopEnded(40000);
+    REQUIRE(device.display == 1);
+    REQUIRE(device.microphone == Color::On);
+
+    INFO("The next status has the next sequence number and is parsed");
+    firmware.udpReceived(40000, std::string("\xc1\x02\x04", 3) + uuid + std::string("\x00\x00\x00\x08", 4));
+    REQUIRE(firmware.stats().unchangedPackets == 1);
+    REQUIRE(device.microphone == Color::Off);
+}
+
+TEST_CASE("Firmware accepts MessagePack status maps") {
+    FakeDevice device;
+    Firmware firmware(device);
+    // {"version":1,"webcam":false,"microphone":true,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"}
+    const std::string packet =
+        "\x84\xa7version\x01\xa6webcam\xc2\xaamicrophone\xc3\xa8senderId"
+        "\xd9\x24" "51000b59-b3eb-4664-a895-e824260d9050";
+
+    firmware.udpReceived(0, R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware.udpReceived(0, packet);
+    firmware.loopEnded(0);
+
+    REQUIRE(device.display == 1);
+    REQUIRE(device.microphone == Color::On);
+    REQUIRE(device.webcam == Color::Off);
+}
+
+namespace {
+
+// Entries for the clients with UUIDs "%08x-b3eb-4664-a895-e824260d9050" from `firstClient` on
+std::string batchFrame(uint32_t firstClient, uint32_t count, bool microphone) {
+    std::vector<StatusMessage> entries(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        entries[i].senderUuid = SenderKey::fromSenderId(fmt("%08x-b3eb-4664-a895-e824260d9050", firstClient + i));
+        entries[i].microphone = microphone;
+    }
+    std::string frame;
+    appendBatchFrame(frame, Span<const StatusMessage>(entries.data(), entries.size()));
+    return frame;
+}
+
+}
+
+TEST_CASE("Firmware applies a relay's batch frame as one transaction") {
+    FakeDevice device;
+    Firmware firmware(device);
+    const int commits = device.commits;
+
+    firmware.udpReceived(0, Endpoint(0xc0a80002, 50000), batchFrame(0, 14, true));
+    firmware.loopEnded(0);
+    REQUIRE(device.display == 14);
+    REQUIRE(device.microphone == Color::On);
+    REQUIRE(device.webcam == Color::Off);
+    REQUIRE(device.commits == commits + 1);
+
+    SECTION("Entries are the same clients as their own packets") {
+        firmware.udpReceived(0, fmt(R"({"version":1,"webcam":true,"microphone":false,"senderId":"%08x-b3eb-4664-a895-e824260d9050"})", 3));
+        firmware.loopEnded(0);
+        REQUIRE(device.display == 14);
+        REQUIRE(device.webcam == Color::On);
+    }
+    SECTION("Fragments are independent frames") {
+        firmware.udpReceived(0, Endpoint(0xc0a80002, 50000), batchFrame(14, 6, false));
+        firmware.loopEnded(0);
+        REQUIRE(device.display == 20);
+    }
+    SECTION("A malformed frame changes nothing") {
+        std::string frame = batchFrame(0, 14, false);
+        frame.pop_back();
+        firmware.udpReceived(0, frame);
+        REQUIRE(device.microphone == Color::On);
+    }
+    SECTION("The relay's endpoint isn't given to the entries") {
+        firmware.udpReceived(0, Endpoint(0xc0a80002, 50000), R"({"version":1,"webcam":false,"microphone":false})");
+        firmware.loopEnded(0);
+        REQUIRE(device.display == 15);
+        REQUIRE(device.microphone == Color::On);
+    }
+    SECTION("Batch frames keep their place among other datagrams") {
+        const std::string before = fmt(R"({"version":1,"webcam":true,"microphone":true,"senderId":"%08x-b3eb-4664-a895-e824260d9050"})", 20);
+        const std::string frame = batchFrame(20, 1, false);
+        const Datagram batch[] = { {before, Endpoint()}, {frame, Endpoint()} };
+        firmware.udpReceivedBatch(0, Span<const Datagram>(batch, 2));
+        firmware.loopEnded(0);
+        REQUIRE(device.display == 15);
+        REQUIRE(device.webcam == Color::Off);
+    }
+}
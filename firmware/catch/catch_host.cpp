@@ -0,0 +1,433 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+#include "host/clientstore.h"
+#include "host/datagramring.h"
+#include "host/hostdevice.h"
+#include "host/networkthread.h"
+#include "host/recvmmsgtransport.h"
+#include "host/shardedhost.h"
+#include "host/udpsocket.h"
+#include "host/uringtransport.h"
+
+namespace {
+
+constexpr uint32_t LOOPBACK = 0x7f000001;
+
+std::string readAll(FILE* file) {
+    std::rewind(file);
+    std::string content;
+    char buffer[256];
+    size_t size;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        content.append(buffer, size);
+    }
+    return content;
+}
+
+void sendTo(int sender, int receiver, const std::string& packet) {
+    sockaddr_in destination = {};
+    destination.sin_family = AF_INET;
+    destination.sin_addr.s_addr = htonl(LOOPBACK);
+    destination.sin_port = htons(boundPort(receiver));
+    REQUIRE( sendto(sender, packet.data(), packet.size(), 0, reinterpret_cast<const sockaddr*>(&destination), sizeof(destination)) == static_cast<ssize_t>(packet.size()) );
+}
+
+}
+
+TEST_CASE( "RecvmmsgTransport reads several datagrams per call" ) {
+    const int receiver = openUdpSocket(LOOPBACK, 0);
+    const int sender = openUdpSocket(LOOPBACK, 0);
+    REQUIRE( receiver >= 0 );
+    REQUIRE( sender >= 0 );
+
+    const std::string packets[] = { "first", std::string(256, 'x'), "second", "third" };
+    for (const std::string& packet : packets) {
+        sendTo(sender, receiver, packet);
+    }
+
+    RecvmmsgTransport<8> transport(receiver);
+    Datagram batch[8];
+    const size_t received = transport.receive(Span<Datagram>(batch, 8));
+
+    REQUIRE( received == 3 );
+    REQUIRE( transport.truncated() == 1 );
+    REQUIRE( transport.syscalls() == 1 );
+    REQUIRE( std::string(batch[0].payload.data(), batch[0].payload.size()) == "first" );
+    REQUIRE( std::string(batch[2].payload.data(), batch[2].payload.size()) == "third" );
+    REQUIRE( batch[1].source == Endpoint(LOOPBACK, boundPort(sender)) );
+
+    REQUIRE( transport.receive(Span<Datagram>(batch, 8)) == 0 );
+    REQUIRE( transport.lastError() == 0 );
+    close(sender);
+    close(receiver);
+}
+
+TEST_CASE( "UringTransport reads datagrams from provided buffers" ) {
+    const int receiver = openUdpSocket(LOOPBACK, 0);
+    const int sender = openUdpSocket(LOOPBACK, 0);
+    REQUIRE( receiver >= 0 );
+    REQUIRE( sender >= 0 );
+    {
+        UringTransport<4> transport(receiver);
+        if (!transport.ok()) {
+            WARN( "io_uring is not available: " << std::strerror(transport.error()) );
+            close(sender);
+            close(receiver);
+            return;
+        }
+        // More datagrams than buffers, so the request has to be rearmed as they are returned
+        const std::string packets[] = { "first", std::string(256, 'x'), "second", "third", "fourth", "fifth", "sixth" };
+        for (const std::string& packet : packets) {
+            sendTo(sender, receiver, packet);
+        }
+
+        std::vector<std::string> received;
+        Datagram batch[8];
+        pollfd ready = { transport.readableFd(), POLLIN, 0 };
+        for (int attempt = 0; attempt < 100 && received.size() < 6 && poll(&ready, 1, 1000) == 1; ++attempt) {
+            const size_t count = transport.receive(Span<Datagram>(batch, 8));
+            for (size_t i = 0; i < count; ++i) {
+                REQUIRE( batch[i].source == Endpoint(LOOPBACK, boundPort(sender)) );
+                received.push_back(std::string(batch[i].payload.data(), batch[i].payload.size()));
+            }
+        }
+
+        const std::vector<std::string> expected = { "first", "second", "third", "fourth", "fifth", "sixth" };
+        REQUIRE( received == expected );
+        REQUIRE( transport.truncated() == 1 );
+        REQUIRE( transport.lastError() == 0 );
+    }
+    close(sender);
+    close(receiver);
+}
+
+TEST_CASE( "HostDevice publishes the state once per loop" ) {
+    FILE* out = std::tmpfile();
+    REQUIRE( out );
+    const std::string statePath = "catch_host_state.json";
+    {
+        HostDevice device(out, nullptr, statePath);
+        Firmware firmware(device);
+        firmware.loopStarted(0);
+        firmware.udpReceived(0, R"({"version":1,"webcam":true,"microphone":false})");
+        firmware.loopEnded(0);
+        firmware.loopStarted(1);
+        firmware.loopEnded(1);
+
+        REQUIRE( device.published() == 1 );
+        REQUIRE( device.webcam() == Color::On );
+        REQUIRE( device.clients() == 1 );
+    }
+    const std::string expected = R"({"microphone":"off","webcam":"on","clients":1})" "\n";
+    REQUIRE( readAll(out) == expected );
+    std::ifstream state(statePath);
+    std::stringstream content;
+    content << state.rdbuf();
+    REQUIRE( content.str() == expected );
+    std::fclose(out);
+    std::remove(statePath.c_str());
+}
+
+TEST_CASE( "DatagramRing hands out datagrams in place until released" ) {
+    std::unique_ptr<DatagramRing<4>> ring = make_unique<DatagramRing<4>>();
+    REQUIRE( reinterpret_cast<uintptr_t>(ring.get()) % 64 == 0 );
+    REQUIRE( ring->available() == 0 );
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 4; ++i) {
+            REQUIRE( ring->push(round, Endpoint(LOOPBACK, static_cast<uint16_t>(i)), fmt("packet %d", i)) );
+        }
+        REQUIRE_FALSE( ring->push(round, Endpoint(), "full"_sv) );
+        REQUIRE( ring->overflows() == static_cast<size_t>(round + 1) );
+        REQUIRE( ring->available() == 4 );
+        REQUIRE( ring->at(3).received == static_cast<Timestamp>(round) );
+        const Datagram datagram = ring->at(1).datagram();
+        REQUIRE( std::string(datagram.payload.data(), datagram.payload.size()) == "packet 1" );
+        REQUIRE( datagram.source == Endpoint(LOOPBACK, 1) );
+        ring->release(4);
+    }
+    REQUIRE_FALSE( ring->push(0, Endpoint(), std::string(256, 'x')) );
+}
+
+TEST_CASE( "DatagramRing keeps the order between threads" ) {
+    constexpr int COUNT = 20000;
+    std::unique_ptr<DatagramRing<16>> ring = make_unique<DatagramRing<16>>();
+    size_t refused = 0;
+    std::thread producer([&] {
+        for (int i = 0; i < COUNT; ++i) {
+            const std::string payload = fmt("packet %d", i);
+            while (!ring->push(i, Endpoint(LOOPBACK, static_cast<uint16_t>(i)), payload)) {
+                ++refused;
+                std::this_thread::yield();
+            }
+        }
+    });
+    int next = 0;
+    bool ordered = true;
+    while (next < COUNT) {
+        const size_t available = ring->available();
+        for (size_t i = 0; i < available; ++i, ++next) {
+            const DatagramRing<16>::Slot& slot = ring->at(i);
+            ordered = ordered && slot.received == static_cast<Timestamp>(next)
+                && slot.source == Endpoint(LOOPBACK, static_cast<uint16_t>(next))
+                && std::string(slot.payload, slot.size) == fmt("packet %d", next);
+        }
+        ring->release(available);
+        if (!available) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    REQUIRE( ordered );
+    REQUIRE( ring->available() == 0 );
+    REQUIRE( ring->overflows() == refused );
+}
+
+TEST_CASE( "NetworkThread drops what doesn't fit while the firmware is behind" ) {
+    const int receiver = openUdpSocket(LOOPBACK, 0);
+    const int sender = openUdpSocket(LOOPBACK, 0);
+    REQUIRE( receiver >= 0 );
+    REQUIRE( sender >= 0 );
+    {
+        RecvmmsgTransport<8> network(receiver);
+        NetworkThread<8, 4> thread(network);
+        REQUIRE( thread.ok() );
+        thread.start();
+        for (int i = 0; i < 10; ++i) {
+            sendTo(sender, receiver, fmt("packet %d", i));
+        }
+        // Nothing is read on this side until the network thread got all of them
+        for (int attempt = 0; attempt < 2000 && thread.overflows() < 6; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        REQUIRE( thread.overflows() == 6 );
+
+        Datagram batch[8];
+        REQUIRE( thread.receive(Span<Datagram>(batch, 8)) == 4 );
+        for (int i = 0; i < 4; ++i) {
+            REQUIRE( std::string(batch[i].payload.data(), batch[i].payload.size()) == fmt("packet %d", i) );
+        }
+
+        // Released by the next receive(), there is room again
+        REQUIRE( thread.receive(Span<Datagram>(batch, 8)) == 0 );
+        sendTo(sender, receiver, "late");
+        pollfd readable = { thread.readableFd(), POLLIN, 0 };
+        REQUIRE( poll(&readable, 1, 2000) == 1 );
+        REQUIRE( thread.receive(Span<Datagram>(batch, 8)) == 1 );
+        REQUIRE( std::string(batch[0].payload.data(), batch[0].payload.size()) == "late" );
+        REQUIRE( batch[0].source.port == boundPort(sender) );
+        thread.stop();
+        REQUIRE( thread.lastError() == 0 );
+        REQUIRE( thread.overflows() == 6 );
+        REQUIRE( thread.syscalls() > network.syscalls() );
+    }
+    close(sender);
+    close(receiver);
+}
+
+namespace {
+
+std::string uuidFor(int sender) {
+    return fmt("%08x-b3eb-4664-a895-e824260d9050", sender);
+}
+
+std::string statusFrom(const std::string& senderId, bool microphone, bool webcam) {
+    return fmt(R"({"version":1,"webcam":%s,"microphone":%s,"senderId":"%s"})",
+        webcam ? "true" : "false", microphone ? "true" : "false", senderId.c_str());
+}
+
+// A v2 status frame with just the webcam flag set
+std::string webcamFrameFor(int sender) {
+    StatusMessage message;
+    message.senderUuid = SenderKey::fromSenderId(uuidFor(sender));
+    message.webcam = true;
+    std::string frame;
+    appendStatusFrame(frame, message);
+    return frame;
+}
+
+// A relay's batch frame with the microphone on for each sender
+std::string batchFrameFor(const std::vector<int>& senders) {
+    std::vector<StatusMessage> entries(senders.size());
+    for (size_t i = 0; i < senders.size(); ++i) {
+        entries[i].senderUuid = SenderKey::fromSenderId(uuidFor(senders[i]));
+        entries[i].microphone = true;
+    }
+    std::string frame;
+    appendBatchFrame(frame, Span<const StatusMessage>(entries.data(), entries.size()));
+    return frame;
+}
+
+}
+
+TEST_CASE( "ShardedHost counts each sender once, whichever socket its datagrams arrive on" ) {
+    HostDevice device(nullptr, nullptr);
+    ShardedHost<8> host(2, LOOPBACK, 0, DEFAULT_CLIENT_TIMEOUT_MS, nullptr, 64, [](int socket) {
+        return std::unique_ptr<I_HostTransport>(new RecvmmsgTransport<8>(socket));
+    });
+    REQUIRE( host.ok() );
+    REQUIRE( host.shards() == 2 );
+    host.start();
+
+    // SO_REUSEPORT spreads the source ports over both sockets
+    std::vector<int> senders;
+    for (int i = 0; i < 8; ++i) {
+        senders.push_back(openUdpSocket(LOOPBACK, 0));
+        REQUIRE( senders.back() >= 0 );
+    }
+    sockaddr_in destination = {};
+    destination.sin_family = AF_INET;
+    destination.sin_addr.s_addr = htonl(LOOPBACK);
+    destination.sin_port = htons(host.port());
+    auto send = [&](int sender, const std::string& packet) {
+        REQUIRE( sendto(sender, packet.data(), packet.size(), 0, reinterpret_cast<const sockaddr*>(&destination), sizeof(destination)) == static_cast<ssize_t>(packet.size()) );
+    };
+    const std::string spaced = fmt(R"({ "version": 1, "webcam": true, "microphone": false, "senderId": "%s" })", uuidFor(1000).c_str());
+    // "senderId":"a" occurs in the text, but it's part of another key: the message is from 1002
+    const std::string decoy = fmt(R"({"version":1,"webcam":false,"microphone":false,"x\"senderId":"a","senderId":"%s"})", uuidFor(1002).c_str());
+    for (int i = 0; i < 8; ++i) {
+        // senders that move between source ports, and between the forms routed with and without parsing
+        send(senders[i], i % 2 ? spaced : statusFrom(uuidFor(1000), false, true));
+        send(senders[i], i % 2 ? webcamFrameFor(1001) : statusFrom(uuidFor(1001), false, true));
+        send(senders[i], i % 2 ? decoy : statusFrom(uuidFor(1002), false, false));
+        send(senders[i], statusFrom(uuidFor(i), false, false));
+    }
+    // a relay speaking for senders of both shards
+    send(senders[0], batchFrameFor({100, 101, 102, 103, 104, 105}));
+
+    pollfd merge = { host.mergeFd(), POLLIN, 0 };
+    for (int attempt = 0; attempt < 100 && device.clients() != 17; ++attempt) {
+        poll(&merge, 1, 20);
+        host.merge(device);
+    }
+    // a sender counted twice would show up after the count has been right once
+    for (int settle = 0; settle < 5; ++settle) {
+        poll(&merge, 1, 20);
+        host.merge(device);
+    }
+    REQUIRE( device.clients() == 17 );
+    REQUIRE( device.microphone() == Color::On );
+    REQUIRE( device.webcam() == Color::On );
+
+    host.stop();
+    const ShardedStats stats = host.stats();
+    REQUIRE( stats.dropped == 0 );
+    REQUIRE( stats.truncated == 0 );
+    for (int sender : senders) {
+        close(sender);
+    }
+}
+
+TEST_CASE( "ClientStore reuses a snapshot only after its readers are done" ) {
+    HostDevice device(nullptr, nullptr);
+    Firmware firmware(device);
+    ClientStore<2> store;
+    ClientStore<2>::Reader reader(store);
+    REQUIRE( reader.ok() );
+    REQUIRE( reader.read([](const ClientSnapshot& snapshot) {
+        REQUIRE( snapshot.version == 0 );
+        REQUIRE( snapshot.clients.empty() );
+    }) );
+
+    firmware.udpReceived(5, statusFrom(uuidFor(1), true, false));
+    firmware.udpReceived(5, statusFrom(uuidFor(2), false, false));
+    store.publish(5, firmware);
+    reader.read([&](const ClientSnapshot& snapshot) {
+        REQUIRE( snapshot.version == 1 );
+        REQUIRE( snapshot.taken == 5 );
+        REQUIRE( snapshot.clients.size() == 2 );
+        REQUIRE( snapshot.clients[0].key == SenderKey::fromSenderId(uuidFor(1)) );
+        REQUIRE( snapshot.microphones == 1 );
+        REQUIRE( snapshot.webcams == 0 );
+
+        INFO( "Publishing while the reader holds the snapshot keeps it as it was" );
+        firmware.udpReceived(6, statusFrom(uuidFor(3), true, true));
+        store.publish(6, firmware);
+        store.publish(7, firmware);
+        REQUIRE( store.retired() == 2 );
+        REQUIRE( store.spare() == 0 );
+        REQUIRE( snapshot.version == 1 );
+        REQUIRE( snapshot.clients.size() == 2 );
+    });
+
+    store.publish(8, firmware);
+    REQUIRE( store.retired() == 1 );
+    REQUIRE( store.spare() == 1 );
+    reader.read([](const ClientSnapshot& snapshot) {
+        REQUIRE( snapshot.version == 4 );
+        REQUIRE( snapshot.clients.size() == 3 );
+        REQUIRE( snapshot.microphones == 2 );
+        REQUIRE( snapshot.webcams == 1 );
+    });
+
+    ClientStore<2>::Reader second(store);
+    REQUIRE( second.ok() );
+    {
+        ClientStore<2>::Reader third(store);
+        REQUIRE_FALSE( third.ok() );
+        bool called = false;
+        REQUIRE_FALSE( third.read([&](const ClientSnapshot&) { called = true; }) );
+        REQUIRE_FALSE( called );
+    }
+}
+
+TEST_CASE( "ClientStore readers see whole snapshots while the writer publishes" ) {
+    constexpr int READERS = 4;
+    constexpr int CLIENTS = 8;
+    HostDevice device(nullptr, nullptr);
+    std::unique_ptr<Firmware> firmware = make_unique<Firmware>(device);
+    ClientStore<READERS> store;
+    std::atomic<bool> done(false);
+    std::atomic<int> inconsistent(0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < READERS; ++i) {
+        readers.emplace_back([&] {
+            ClientStore<READERS>::Reader reader(store);
+            if (!reader.ok()) {
+                ++inconsistent;
+                return;
+            }
+            uint64_t lastVersion = 0;
+            while (!done) {
+                reader.read([&](const ClientSnapshot& snapshot) {
+                    // Every publish toggles one client's microphone and webcam together
+                    size_t microphones = 0;
+                    for (const ClientStatus& client : snapshot.clients) {
+                        microphones += client.microphone;
+                        if (client.microphone != client.webcam) {
+                            ++inconsistent;
+                        }
+                    }
+                    if (microphones != snapshot.microphones || snapshot.webcams != snapshot.microphones
+                            || snapshot.version < lastVersion || snapshot.clients.size() > CLIENTS) {
+                        ++inconsistent;
+                    }
+                    lastVersion = snapshot.version;
+                });
+            }
+        });
+    }
+    for (int round = 0; round < 5000; ++round) {
+        const bool on = (round / CLIENTS) % 2 == 0;
+        firmware->udpReceived(static_cast<Timestamp>(round), statusFrom(uuidFor(round % CLIENTS), on, on));
+        store.publish(static_cast<Timestamp>(round), *firmware);
+    }
+    done = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    REQUIRE( inconsistent == 0 );
+    // Without readers everything replaced is reusable
+    store.publish(5000, *firmware);
+    REQUIRE( store.retired() == 1 );
+}
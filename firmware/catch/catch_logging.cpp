@@ -0,0 +1,91 @@
+#include "catch.hpp"
+
+#include <vector>
+
+#include "logging.h"
+
+namespace {
+    std::string render(LogToken token) {
+        std::string text;
+        renderLog(text, logFormat(token));
+        return text;
+    }
+
+    template<class... Args>
+    std::string render(LogToken token, const Args&... args) {
+        std::string text;
+        renderLog(text, logFormat(token), args...);
+        return text;
+    }
+
+    template<class... Args>
+    std::vector<uint8_t> encode(LogToken token, const Args&... args) {
+        LogFrame frame;
+        const StringView bytes = frame.encode(token, args...);
+        return std::vector<uint8_t>(bytes.begin(), bytes.end());
+    }
+}
+
+TEST_CASE( "log messages are rendered as text" ) {
+    REQUIRE( render(LogToken::TooManyClients) == "Too many clients, packet ignored\n" );
+    REQUIRE( render(LogToken::SenderId, "abc") == "senderId abc\n" );
+    REQUIRE( render(LogToken::UdpPacketContents, R"({"version":1})"_sv) == "UDP packet contents: {\"version\":1}\n" );
+    REQUIRE( render(LogToken::UdpReceived, -12, "10.0.0.2", uint16_t(26999)) == "Received -12 bytes from 10.0.0.2, port 26999\n" );
+    REQUIRE( render(LogToken::ButtonChanged, true) == "button goes true\n" );
+    REQUIRE( render(LogToken::UdpReceived, 100, LogIPv4{{10, 0, 0, 2}}, uint16_t(26999)) == "Received 100 bytes from 10.0.0.2, port 26999\n" );
+    REQUIRE( render(LogToken::SenderId, LogSenderId{"51000B59-b3eb-4664-a895-e824260d9050"_sv}) == "senderId 51000B59-b3eb-4664-a895-e824260d9050\n" );
+}
+
+TEST_CASE( "log messages are encoded as token frames" ) {
+    REQUIRE( encode(LogToken::TooManyClients) == std::vector<uint8_t>{ LOG_FRAME_MARKER, 1, 6 } );
+    REQUIRE( encode(LogToken::SenderId, "ab") == std::vector<uint8_t>{ LOG_FRAME_MARKER, 5, 3, 's', 2, 'a', 'b' } );
+    REQUIRE( encode(LogToken::UdpReceived, -2, "", uint16_t(300)) == std::vector<uint8_t>{ LOG_FRAME_MARKER, 8, 9, 'i', 3, 's', 0, 'u', 0xac, 0x02 } );
+    REQUIRE( encode(LogToken::ButtonChanged, false) == std::vector<uint8_t>{ LOG_FRAME_MARKER, 2, 10, 'F' } );
+}
+
+TEST_CASE( "addresses and UUIDs are encoded as raw bytes" ) {
+    REQUIRE( encode(LogToken::UdpReceived, 100, LogIPv4{{10, 0, 0, 2}}, uint16_t(26999))
+        == std::vector<uint8_t>{ LOG_FRAME_MARKER, 13, 9, 'i', 0xc8, 0x01, 'a', 10, 0, 0, 2, 'u', 0xf7, 0xd2, 0x01 } );
+    REQUIRE( encode(LogToken::SenderId, LogSenderId{"51000b59-b3eb-4664-a895-e824260d9050"_sv})
+        == std::vector<uint8_t>{ LOG_FRAME_MARKER, 18, 3, 'U', 0x51, 0x00, 0x0b, 0x59, 0xb3, 0xeb, 0x46, 0x64, 0xa8, 0x95, 0xe8, 0x24, 0x26, 0x0d, 0x90, 0x50 } );
+    INFO( "Other senderIds stay strings" );
+    REQUIRE( encode(LogToken::SenderId, LogSenderId{"ab"_sv}) == std::vector<uint8_t>{ LOG_FRAME_MARKER, 5, 3, 's', 2, 'a', 'b' } );
+}
+
+TEST_CASE( "long log frames get a two byte length and truncated strings" ) {
+    const std::string payload(300, 'x');
+    const auto frame = encode(LogToken::UdpPacketContents, StringView(payload));
+    REQUIRE( frame.size() < 256 );
+    REQUIRE( frame[0] == LOG_FRAME_MARKER );
+    REQUIRE( (frame[1] & 0x80) );
+    const size_t body = (frame[1] & 0x7f) | (frame[2] << 7);
+    REQUIRE( body == frame.size() - 3 );
+    REQUIRE( frame[3] == static_cast<uint8_t>(LogToken::UdpPacketContents) );
+    REQUIRE( frame[4] == 's' );
+    const size_t length = (frame[5] & 0x7f) | (frame[6] << 7);
+    REQUIRE( length == frame.size() - 7 );
+}
+
+TEST_CASE( "a long string leaves room for the arguments after it" ) {
+    const std::string payload(248, 'x');
+    const auto frame = encode(LogToken::UdpReceived, StringView(payload), LogSenderId{"51000b59-b3eb-4664-a895-e824260d9050"_sv}, uint16_t(26999));
+    REQUIRE( frame.size() == 253 );
+    const size_t body = (frame[1] & 0x7f) | (frame[2] << 7);
+    REQUIRE( body == frame.size() - 3 );
+    REQUIRE( frame[3] == static_cast<uint8_t>(LogToken::UdpReceived) );
+    REQUIRE( frame[4] == 's' );
+    const size_t length = (frame[5] & 0x7f) | (frame[6] << 7);
+    REQUIRE( length == 225 );
+    REQUIRE( std::string(frame.begin() + 7, frame.begin() + 7 + length) == payload.substr(0, length) );
+    const std::vector<uint8_t> rest(frame.begin() + 7 + length, frame.end());
+    REQUIRE( rest == std::vector<uint8_t>{ 'U', 0x51, 0x00, 0x0b, 0x59, 0xb3, 0xeb, 0x46, 0x64, 0xa8, 0x95, 0xe8, 0x24, 0x26, 0x0d, 0x90, 0x50, 'u', 0xf7, 0xd2, 0x01 } );
+
+    INFO( "Two long strings" );
+    const auto strings = encode(LogToken::UdpReceived, StringView(payload), StringView(payload), uint64_t(UINT64_MAX));
+    REQUIRE( strings.size() <= 253 );
+    const size_t first = (strings[5] & 0x7f) | (strings[6] << 7);
+    REQUIRE( strings[7 + first] == 's' );
+    const size_t second = strings[8 + first];
+    REQUIRE( 9 + first + second + 11 == strings.size() );
+    REQUIRE( strings[9 + first + second] == 'u' );
+}
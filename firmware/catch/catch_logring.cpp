@@ -0,0 +1,64 @@
+#include "catch.hpp"
+
+#include <string>
+
+#include "logring.h"
+
+namespace {
+    template<size_t Capacity>
+    std::string drainAll(LogRing<Capacity>& ring, size_t maxBytes = static_cast<size_t>(-1)) {
+        std::string result;
+        ring.drain(maxBytes, [&result](const char* data, size_t size) {
+            result.append(data, size);
+            return size;
+        });
+        return result;
+    }
+}
+
+TEST_CASE( "LogRing buffers messages until drained" ) {
+    LogRing<16> ring;
+    REQUIRE( ring.empty() );
+
+    REQUIRE( ring.append("hello "_sv) );
+    REQUIRE( ring.append("world"_sv) );
+    REQUIRE( ring.size() == 11 );
+    REQUIRE( drainAll(ring) == "hello world" );
+    REQUIRE( ring.empty() );
+}
+
+TEST_CASE( "LogRing wraps around" ) {
+    LogRing<8> ring;
+    REQUIRE( ring.append("abcdef"_sv) );
+    REQUIRE( drainAll(ring, 4) == "abcd" );
+    REQUIRE( ring.append("ghijk"_sv) );
+    REQUIRE( ring.size() == 7 );
+    REQUIRE( drainAll(ring) == "efghijk" );
+}
+
+TEST_CASE( "LogRing drops messages that don't fit" ) {
+    LogRing<8> ring;
+    REQUIRE( ring.append("abcdef"_sv) );
+    REQUIRE_FALSE( ring.append("ghi"_sv) );
+    REQUIRE( ring.append("gh"_sv) );
+    REQUIRE_FALSE( ring.append("i"_sv) );
+    REQUIRE_FALSE( ring.append("0123456789"_sv) );
+    REQUIRE( ring.droppedBytes() == 14 );
+    REQUIRE( ring.droppedMessages() == 3 );
+    REQUIRE( drainAll(ring) == "abcdefgh" );
+}
+
+TEST_CASE( "LogRing stops draining when the writer is full" ) {
+    LogRing<8> ring;
+    REQUIRE( ring.append("abcdef"_sv) );
+
+    std::string written;
+    const auto drained = ring.drain(100, [&written](const char* data, size_t size) {
+        const size_t room = 4 - written.size();
+        written.append(data, std::min(size, room));
+        return std::min(size, room);
+    });
+    REQUIRE( drained == 4 );
+    REQUIRE( written == "abcd" );
+    REQUIRE( drainAll(ring) == "ef" );
+}
@@ -1,2 +1,3 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
+#define CATCH_CONFIG_NO_POSIX_SIGNALS // glibc >= 2.34 makes MINSIGSTKSZ non-constant, which this catch.hpp cannot handle
 #include "catch.hpp"
@@ -0,0 +1,118 @@
+#include "catch.hpp"
+
+#include "shadowdevice.h"
+
+namespace {
+
+class CountingDevice : public I_Device {
+public:
+    int logs = 0;
+    int microphoneWrites = 0;
+    int webcamWrites = 0;
+    int displayWrites = 0;
+    int frames = 0;
+    int commits = 0;
+    Color microphone = Color::Standby;
+    Color webcam = Color::Standby;
+    int display = 0;
+
+    virtual void log(StringView) override { ++logs; }
+    virtual void setMicrophoneLeds(Color color) override { ++microphoneWrites; microphone = color; }
+    virtual void setWebcamLeds(Color color) override { ++webcamWrites; webcam = color; }
+    virtual void displayNumber(int number) override { ++displayWrites; display = number; }
+    virtual void beginLedFrame() override { ++frames; }
+    virtual void commitLedFrame() override { ++commits; }
+};
+
+}
+
+TEST_CASE( "ShadowDevice forwards only changes" ) {
+    CountingDevice hardware;
+    ShadowDevice device(hardware);
+
+    INFO("the first write is always forwarded");
+    device.setMicrophoneLeds(Color::Standby);
+    device.setWebcamLeds(Color::Standby);
+    device.displayNumber(0);
+    REQUIRE( hardware.microphoneWrites == 1 );
+    REQUIRE( hardware.webcamWrites == 1 );
+    REQUIRE( hardware.displayWrites == 1 );
+
+    INFO("repeated writes are suppressed");
+    for (int i = 0; i < 10; ++i) {
+        device.setMicrophoneLeds(Color::Standby);
+        device.setWebcamLeds(Color::Standby);
+        device.displayNumber(0);
+    }
+    REQUIRE( hardware.microphoneWrites == 1 );
+    REQUIRE( hardware.webcamWrites == 1 );
+    REQUIRE( hardware.displayWrites == 1 );
+
+    INFO("changes are forwarded");
+    device.setMicrophoneLeds(Color::On);
+    device.setWebcamLeds(Color::Standby);
+    device.displayNumber(2);
+    REQUIRE( hardware.microphoneWrites == 2 );
+    REQUIRE( hardware.microphone == Color::On );
+    REQUIRE( hardware.webcamWrites == 1 );
+    REQUIRE( hardware.displayWrites == 2 );
+    REQUIRE( hardware.display == 2 );
+
+    REQUIRE( device.forwardedWrites() == 5 );
+    REQUIRE( device.suppressedWrites() == 31 );
+
+    INFO("logs are passed through");
+    device.log("hello"_sv);
+    device.log("hello"_sv);
+    REQUIRE( hardware.logs == 2 );
+}
+
+TEST_CASE( "ShadowDevice forwards only frames that change something" ) {
+    CountingDevice hardware;
+    ShadowDevice device(hardware);
+
+    device.beginLedFrame();
+    device.setMicrophoneLeds(Color::On);
+    device.setWebcamLeds(Color::Off);
+    device.commitLedFrame();
+    REQUIRE( hardware.frames == 1 );
+    REQUIRE( hardware.commits == 1 );
+
+    device.beginLedFrame();
+    device.setMicrophoneLeds(Color::On);
+    device.setWebcamLeds(Color::Off);
+    device.commitLedFrame();
+    REQUIRE( hardware.frames == 1 );
+    REQUIRE( hardware.commits == 1 );
+
+    device.beginLedFrame();
+    device.setMicrophoneLeds(Color::On);
+    device.setWebcamLeds(Color::On);
+    device.commitLedFrame();
+    REQUIRE( hardware.frames == 2 );
+    REQUIRE( hardware.commits == 2 );
+    REQUIRE( hardware.webcam == Color::On );
+}
+
+TEST_CASE( "ShadowDevice keeps Firmware loops from writing the hardware" ) {
+    CountingDevice hardware;
+    ShadowDevice device(hardware);
+    Firmware firmware(device);
+
+    firmware.loopStarted(0);
+    firmware.udpReceived(0, R"({"version":1,"webcam":true,"microphone":false,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})");
+    firmware.loopEnded(0);
+    const auto microphoneWrites = hardware.microphoneWrites;
+    const auto webcamWrites = hardware.webcamWrites;
+    const auto displayWrites = hardware.displayWrites;
+
+    for (Timestamp ts = 1; ts < 1000; ++ts) {
+        firmware.loopStarted(ts);
+        firmware.loopEnded(ts);
+    }
+    REQUIRE( hardware.microphoneWrites == microphoneWrites );
+    REQUIRE( hardware.webcamWrites == webcamWrites );
+    REQUIRE( hardware.displayWrites == displayWrites );
+    REQUIRE( hardware.webcam == Color::On );
+    REQUIRE( hardware.display == 1 );
+}
@@ -0,0 +1,219 @@
+#include "catch.hpp"
+
+#include <string>
+
+#include "statusparser.h"
+
+namespace {
+
+std::string senderIdOf(const StatusMessage& message) {
+    return std::string(message.senderId.data(), message.senderId.size());
+}
+
+bool pointsInto(StringView view, const std::string& packet) {
+    return view.data() >= packet.data() && view.data() + view.size() <= packet.data() + packet.size();
+}
+
+}
+
+TEST_CASE( "StatusParser reads the minified form in place" ) {
+    StatusParser parser;
+    StatusMessage message;
+    for (int webcam = 0; webcam < 2; ++webcam) {
+        for (int microphone = 0; microphone < 2; ++microphone) {
+            const std::string packet = fmt(R"({"version":1,"webcam":%s,"microphone":%s,"senderId":"51000b59-b3eb-4664-a895-e824260d9050"})",
+                webcam ? "true" : "false", microphone ? "true" : "false");
+            REQUIRE( parser.parse(packet, message) == nullptr );
+            REQUIRE( message.version == 1 );
+            REQUIRE( message.webcam == static_cast<bool>(webcam) );
+            REQUIRE( message.microphone == static_cast<bool>(microphone) );
+            REQUIRE( senderIdOf(message) == "51000b59-b3eb-4664-a895-e824260d9050" );
+            REQUIRE( pointsInto(message.senderId, packet) );
+        }
+    }
+
+    REQUIRE( parser.parse(R"({"version":1,"webcam":true,"microphone":false})"_sv, message) == nullptr );
+    REQUIRE_FALSE( message.hasSenderId() );
+
+    const std::string empty = R"({"version":1,"webcam":true,"microphone":false,"senderId":""})";
+    REQUIRE( parser.parse(empty, message) == nullptr );
+    REQUIRE( message.hasSenderId() );
+    REQUIRE( message.senderId.size() == 0 );
+}
+
+TEST_CASE( "StatusParser falls back to ArduinoJson for other layouts" ) {
+    StatusParser parser;
+    StatusMessage message;
+
+    SECTION( "whitespace and a different key order" ) {
+        REQUIRE( parser.parse("{ \"senderId\": \"abc\", \"microphone\": true,\n \"webcam\": false, \"version\": 1 }"_sv, message) == nullptr );
+        REQUIRE( message.microphone );
+        REQUIRE_FALSE( message.webcam );
+        REQUIRE( senderIdOf(message) == "abc" );
+    }
+    SECTION( "escapes in the senderId" ) {
+        REQUIRE( parser.parse(R"({"version":1,"webcam":false,"microphone":false,"senderId":"a\"bA"})"_sv, message) == nullptr );
+        REQUIRE( senderIdOf(message) == "a\"bA" );
+    }
+    SECTION( "unknown properties" ) {
+        REQUIRE( parser.parse(R"({"version":1,"webcam":true,"microphone":true,"hostname":"x"})"_sv, message) == nullptr );
+        REQUIRE( message.webcam );
+        REQUIRE( message.microphone );
+    }
+}
+
+TEST_CASE( "StatusParser rejects messages breaking the schema" ) {
+    StatusParser parser;
+    StatusMessage message;
+    REQUIRE( parser.parse("not json"_sv, message) != nullptr );
+    REQUIRE( parser.parse("[1, 2]"_sv, message) != nullptr );
+    REQUIRE( parser.parse(R"({"version":1,"webcam":true,"microphone":false)"_sv, message) != nullptr );
+    REQUIRE( parser.parse(R"({"webcam":true,"microphone":false})"_sv, message) != nullptr );
+    REQUIRE( parser.parse(R"({"version":2,"webcam":true,"microphone":false})"_sv, message) != nullptr );
+    REQUIRE( parser.parse(R"({"version":"1","webcam":true,"microphone":false})"_sv, message) != nullptr );
+    REQUIRE( parser.parse(R"({"version":1,"microphone":false})"_sv, message) != nullptr );
+    REQUIRE( parser.parse(R"({"version":1,"webcam":true})"_sv, message) != nullptr );
+    REQUIRE( parser.parse(R"({"version":1,"webcam":1,"microphone":false})"_sv, message) != nullptr );
+    REQUIRE( parser.parse(R"({"version":1,"webcam":true,"microphone":false,"senderId":42})"_sv, message) != nullptr );
+}
+
+TEST_CASE( "StatusParser decodes binary v2 frames" ) {
+    // 51000b59-b3eb-4664-a895-e824260d9050
+    const std::string uuid("\x51\x00\x0b\x59\xb3\xeb\x46\x64\xa8\x95\xe8\x24\x26\x0d\x90\x50", 16);
+    StatusParser parser;
+    StatusMessage message;
+
+    SECTION( "without a sequence number" ) {
+        const std::string frame = std::string("\xc1\x02\x01", 3) + uuid;
+        REQUIRE( frame.size() == 19 );
+        REQUIRE( parser.parse(frame, message) == nullptr );
+        REQUIRE( message.version == 2 );
+        REQUIRE( message.microphone );
+        REQUIRE_FALSE( message.webcam );
+        REQUIRE_FALSE( message.hasSequence );
+        REQUIRE_FALSE( message.hasSenderId() );
+        REQUIRE( message.senderUuid == SenderKey::fromSenderId("51000b59-b3eb-4664-a895-e824260d9050"_sv) );
+    }
+    SECTION( "with a sequence number" ) {
+        const std::string frame = std::string("\xc1\x02\x06", 3) + uuid + std::string("\x01\x02\x03\x04", 4);
+        REQUIRE( StatusParser::decodeFrame(frame, message) == nullptr );
+        REQUIRE_FALSE( message.microphone );
+        REQUIRE( message.webcam );
+        REQUIRE( message.hasSequence );
+        REQUIRE( message.sequence == 0x01020304 );
+    }
+    SECTION( "malformed frames" ) {
+        REQUIRE( parser.parse(std::string("\xc1\x02\x01", 3) + uuid.substr(1), message) != nullptr );
+        REQUIRE( parser.parse(std::string("\xc1\x02\x05", 3) + uuid, message) != nullptr );
+        REQUIRE( parser.parse(std::string("\xc1\x01\x01", 3) + uuid, message) != nullptr );
+        REQUIRE( parser.parse(std::string("\xc1\x02\x09", 3) + uuid, message) != nullptr );
+        REQUIRE( parser.parse(std::string("\xc1", 1), message) != nullptr );
+    }
+}
+
+namespace {
+
+// MessagePack str 8
+std::string msgPackString(const std::string& text) {
+    return std::string("\xd9", 1) + static_cast<char>(text.size()) + text;
+}
+
+}
+
+TEST_CASE( "StatusParser accepts MessagePack maps" ) {
+    const std::string version = msgPackString("version") + "\x01";
+    const std::string webcamOn = msgPackString("webcam") + "\xc3";
+    const std::string microphoneOff = msgPackString("microphone") + "\xc2";
+    const std::string senderId = msgPackString("senderId") + msgPackString("51000b59-b3eb-4664-a895-e824260d9050");
+    StatusParser parser;
+    StatusMessage message;
+
+    SECTION( "all fields" ) {
+        const std::string packet = "\x84" + version + webcamOn + microphoneOff + senderId;
+        REQUIRE( StatusParser::isMsgPack(packet) );
+        REQUIRE_FALSE( StatusParser::isText(packet) );
+        REQUIRE( parser.parse(packet, message) == nullptr );
+        REQUIRE( message.version == 1 );
+        REQUIRE( message.webcam );
+        REQUIRE_FALSE( message.microphone );
+        REQUIRE( senderIdOf(message) == "51000b59-b3eb-4664-a895-e824260d9050" );
+    }
+    SECTION( "map 16 without senderId" ) {
+        const std::string packet = std::string("\xde\x00\x03", 3) + microphoneOff + version + webcamOn;
+        REQUIRE( parser.parse(packet, message) == nullptr );
+        REQUIRE_FALSE( message.hasSenderId() );
+    }
+    SECTION( "the same schema rules" ) {
+        REQUIRE( parser.parse("\x82" + version + webcamOn, message) != nullptr );
+        REQUIRE( parser.parse("\x83" + webcamOn + microphoneOff + senderId, message) != nullptr );
+        REQUIRE( parser.parse("\x83" + msgPackString("version") + "\x02" + webcamOn + microphoneOff, message) != nullptr );
+        REQUIRE( parser.parse("\x84" + version + webcamOn + microphoneOff, message) != nullptr );
+    }
+}
+
+TEST_CASE( "StatusParser checks batch frames as a whole" ) {
+    const std::string uuid("\x51\x00\x0b\x59\xb3\xeb\x46\x64\xa8\x95\xe8\x24\x26\x0d\x90\x50", 16);
+    const std::string header("\xc1\x02\x08", 3);
+    size_t count = 0;
+
+    SECTION( "valid" ) {
+        const std::string frame = header + "\x02" + "\x01" + uuid + "\x02" + uuid;
+        REQUIRE( StatusParser::isBatchFrame(frame) );
+        REQUIRE( StatusParser::checkBatchFrame(frame, count) == nullptr );
+        REQUIRE( count == 2 );
+        StatusMessage message;
+        StatusParser::decodeBatchEntry(frame, 1, message);
+        REQUIRE_FALSE( message.microphone );
+        REQUIRE( message.webcam );
+        REQUIRE( message.senderUuid == SenderKey::fromSenderId("51000b59-b3eb-4664-a895-e824260d9050"_sv) );
+    }
+    SECTION( "the largest batch fits the receive buffer" ) {
+        std::string frame = header + "\x0e";
+        for (int i = 0; i < 14; ++i) {
+            frame += "\x03" + uuid;
+        }
+        REQUIRE( frame.size() <= 255 );
+        REQUIRE( StatusParser::checkBatchFrame(frame, count) == nullptr );
+        REQUIRE( count == 14 );
+        frame[3] = 15;
+        frame += "\x03" + uuid;
+        REQUIRE( StatusParser::checkBatchFrame(frame, count) != nullptr );
+    }
+    SECTION( "malformed" ) {
+        REQUIRE( StatusParser::checkBatchFrame(header + "\x00", count) != nullptr );
+        REQUIRE( StatusParser::checkBatchFrame(header + "\x02" + "\x01" + uuid, count) != nullptr );
+        REQUIRE( StatusParser::checkBatchFrame(header + "\x01" + "\x04" + uuid, count) != nullptr );
+        REQUIRE( StatusParser::checkBatchFrame(std::string("\xc1\x02\x09\x01", 4) + "\x01" + uuid, count) != nullptr );
+        REQUIRE( StatusParser::checkBatchFrame(std::string("\xc1\x03\x08\x01", 4) + "\x01" + uuid, count) != nullptr );
+    }
+}
+
+TEST_CASE( "Status frames are encoded as StatusParser decodes them" ) {
+    StatusMessage message;
+    message.senderUuid = SenderKey::fromSenderId("51000b59-b3eb-4664-a895-e824260d9050"_sv);
+    message.microphone = true;
+    message.hasSequence = true;
+    message.sequence = 7;
+
+    SECTION( "the example of doc/Protocol.md" ) {
+        std::string frame;
+        appendStatusFrame(frame, message);
+        REQUIRE( frame == std::string("\xc1\x02\x05\x51\x00\x0b\x59\xb3\xeb\x46\x64\xa8\x95\xe8\x24\x26\x0d\x90\x50\x00\x00\x00\x07", 23) );
+    }
+    SECTION( "a batch" ) {
+        StatusMessage entries[2] = { message, message };
+        entries[1].senderUuid.lo ^= 1;
+        entries[1].microphone = false;
+        entries[1].webcam = true;
+        std::string frame;
+        appendBatchFrame(frame, Span<const StatusMessage>(entries, 2));
+        size_t count = 0;
+        REQUIRE( StatusParser::checkBatchFrame(frame, count) == nullptr );
+        REQUIRE( count == 2 );
+        StatusMessage decoded;
+        StatusParser::decodeBatchEntry(frame, 1, decoded);
+        REQUIRE( decoded.senderUuid == entries[1].senderUuid );
+        REQUIRE_FALSE( decoded.microphone );
+        REQUIRE( decoded.webcam );
+    }
+}
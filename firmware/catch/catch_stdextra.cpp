@@ -5,3 +5,39 @@
 TEST_CASE( "fmt() works" ) {
     REQUIRE( fmt("Hello, %s!", "World") == "Hello, World!" );
 }
+
+TEST_CASE( "InlineString appends in place" ) {
+    InlineString<8> str;
+    REQUIRE( str.empty() );
+    REQUIRE( str == ""_sv );
+
+    REQUIRE( str.append("abc") );
+    REQUIRE( str.append("def", 3) );
+    REQUIRE( str == "abcdef"_sv );
+    REQUIRE( std::string(str.c_str()) == "abcdef" );
+
+    REQUIRE_FALSE( str.append("ghi") );
+    REQUIRE( str == "abcdefgh"_sv );
+    REQUIRE( str.size() == 8 );
+    REQUIRE( std::string(str.c_str()) == "abcdefgh" );
+
+    str.clear();
+    REQUIRE( str.empty() );
+    REQUIRE( std::string(str.c_str()).empty() );
+}
+
+TEST_CASE( "fmt() into InlineString reports truncation" ) {
+    InlineString<16> str;
+    REQUIRE( fmt(str, "Hello, %s!", "World") );
+    REQUIRE( str == "Hello, World!"_sv );
+
+    REQUIRE( fmt(str, "%d", 42) );
+    REQUIRE( str == "42"_sv );
+
+    REQUIRE_FALSE( fmt(str, "CheckMeet_%06X and more", 0xabcdefu) );
+    REQUIRE( str == "CheckMeet_ABCDEF"_sv );
+    REQUIRE( str.size() == 16 );
+
+    const StringView view = str;
+    REQUIRE( view.size() == 16 );
+}
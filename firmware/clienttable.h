@@ -0,0 +1,314 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include "stdextra.h"
+
+// IPv4 address and port a datagram came from. They are only compared, so the
+// address may be in whatever byte order the platform hands it out.
+// Port 0 means the source is unknown.
+struct Endpoint {
+    uint32_t ip = 0;
+    uint16_t port = 0;
+
+    Endpoint() = default;
+    Endpoint(uint32_t ip, uint16_t port) : ip(ip), port(port) {}
+
+    bool known() const { return port != 0; }
+
+    uint32_t hash() const {
+        uint64_t x = (static_cast<uint64_t>(ip) << 16 | port) * 0x9e3779b97f4a7c15ULL;
+        return static_cast<uint32_t>(x >> 32);
+    }
+
+    bool operator==(const Endpoint& other) const { return ip == other.ip && port == other.port; }
+    bool operator!=(const Endpoint& other) const { return !(*this == other); }
+};
+
+// Fixed width binary form of a `senderId`. UUIDs are stored as their 128 bits,
+// any other string is hashed down to the same width.
+struct SenderKey {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    static SenderKey fromSenderId(StringView senderId) {
+        SenderKey key;
+        if (!parseUuid(senderId, key)) {
+            key.hi = hashBytes(senderId);
+            key.lo = hashBytes(senderId, 0x9e3779b97f4a7c15ULL);
+        }
+        return key;
+    }
+
+    // Key for senders without a `senderId`. The upper half is zero, which no
+    // random (version 4) UUID has.
+    static SenderKey fromEndpoint(const Endpoint& source) {
+        SenderKey key;
+        key.lo = static_cast<uint64_t>(source.ip) << 16 | source.port;
+        return key;
+    }
+
+    // Accepts the canonical 8-4-4-4-12 form, in either case
+    static bool parseUuid(StringView text, SenderKey& key) {
+        if (text.size() != 36) {
+            return false;
+        }
+        uint64_t words[2] = { 0, 0 };
+        int nibbles = 0;
+        for (size_t i = 0; i < text.size(); ++i) {
+            const char c = text.data()[i];
+            if (i == 8 || i == 13 || i == 18 || i == 23) {
+                if (c != '-') {
+                    return false;
+                }
+                continue;
+            }
+            int value;
+            if (c >= '0' && c <= '9') {
+                value = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                value = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                value = c - 'A' + 10;
+            } else {
+                return false;
+            }
+            uint64_t& word = words[nibbles / 16];
+            word = (word << 4) | static_cast<uint64_t>(value);
+            ++nibbles;
+        }
+        key.hi = words[0];
+        key.lo = words[1];
+        return true;
+    }
+
+    // The 16 bytes of a UUID key, in the order of its text form
+    void uuidBytes(char (&bytes)[16]) const {
+        for (int i = 0; i < 8; ++i) {
+            bytes[i] = static_cast<char>(hi >> (56 - 8 * i));
+            bytes[8 + i] = static_cast<char>(lo >> (56 - 8 * i));
+        }
+    }
+
+    uint32_t hash() const {
+        uint64_t x = hi ^ (lo * 0x9e3779b97f4a7c15ULL);
+        x ^= x >> 32;
+        x *= 0xd6e8feb86659fd93ULL;
+        x ^= x >> 32;
+        return static_cast<uint32_t>(x);
+    }
+
+    bool operator==(const SenderKey& other) const { return hi == other.hi && lo == other.lo; }
+    bool operator!=(const SenderKey& other) const { return !(*this == other); }
+};
+
+// Hash and length of a raw packet, identifies byte-identical repeats without
+// keeping the packet itself
+struct PayloadFingerprint {
+    uint64_t bytesHash = 0;
+    uint32_t size = 0;
+
+    static PayloadFingerprint of(StringView payload) {
+        PayloadFingerprint fingerprint;
+        fingerprint.bytesHash = hashBytes(payload);
+        fingerprint.size = static_cast<uint32_t>(payload.size());
+        return fingerprint;
+    }
+
+    uint32_t hash() const { return static_cast<uint32_t>(bytesHash ^ (bytesHash >> 32)); }
+
+    bool operator==(const PayloadFingerprint& other) const { return bytesHash == other.bytesHash && size == other.size; }
+    bool operator!=(const PayloadFingerprint& other) const { return !(*this == other); }
+};
+
+constexpr size_t nextPowerOfTwo(size_t n, size_t result = 1) {
+    return result >= n ? result : nextPowerOfTwo(n, result * 2);
+}
+
+// Open addressing hash map with linear probing and a fixed number of buckets.
+// Erase uses backward shifting, so there are no tombstones to clean up.
+// `Key` has to provide `uint32_t hash() const` and `operator==`.
+template<class Key, class Value, size_t MinBuckets>
+class FlatMap {
+    static constexpr size_t BUCKETS = nextPowerOfTwo(MinBuckets);
+    static constexpr size_t MASK = BUCKETS - 1;
+
+    struct Bucket {
+        Key key;
+        Value value;
+        bool used = false;
+    };
+    Bucket m_Buckets[BUCKETS];
+    size_t m_Size = 0;
+
+    size_t home(const Key& key) const { return key.hash() & MASK; }
+
+public:
+    static constexpr size_t capacity() { return BUCKETS; }
+    size_t size() const { return m_Size; }
+
+    const Value* find(const Key& key) const {
+        for (size_t i = home(key); m_Buckets[i].used; i = (i + 1) & MASK) {
+            if (m_Buckets[i].key == key) {
+                return &m_Buckets[i].value;
+            }
+        }
+        return nullptr;
+    }
+
+    // Returns false if the map is full
+    bool insert(const Key& key, const Value& value) {
+        size_t i = home(key);
+        for (; m_Buckets[i].used; i = (i + 1) & MASK) {
+            if (m_Buckets[i].key == key) {
+                m_Buckets[i].value = value;
+                return true;
+            }
+        }
+        if (m_Size + 1 >= BUCKETS) { // keep one bucket empty so that probing terminates
+            return false;
+        }
+        m_Buckets[i].key = key;
+        m_Buckets[i].value = value;
+        m_Buckets[i].used = true;
+        ++m_Size;
+        return true;
+    }
+
+    bool erase(const Key& key) {
+        size_t i = home(key);
+        for (; m_Buckets[i].used; i = (i + 1) & MASK) {
+            if (m_Buckets[i].key == key) {
+                break;
+            }
+        }
+        if (!m_Buckets[i].used) {
+            return false;
+        }
+        // Move later members of the probe sequence back into the hole
+        for (size_t j = (i + 1) & MASK; m_Buckets[j].used; j = (j + 1) & MASK) {
+            const size_t h = home(m_Buckets[j].key);
+            const bool movable = i <= j ? (h <= i || h > j) : (h <= i && h > j);
+            if (movable) {
+                m_Buckets[i] = m_Buckets[j];
+                i = j;
+            }
+        }
+        m_Buckets[i].used = false;
+        --m_Size;
+        return true;
+    }
+};
+
+// Fixed capacity table of clients indexed by SenderKey. Values live in a
+// contiguous slot array and keep their SlotId until erased.
+// Slots are also linked into a list in the order they were last touched, so
+// the least recently updated client is available without a scan.
+template<class T, size_t Capacity>
+class ClientTable {
+public:
+    using SlotId = typename std::conditional<Capacity < 0xffff, uint16_t, uint32_t>::type;
+    static constexpr SlotId NO_SLOT = std::numeric_limits<SlotId>::max();
+
+private:
+    struct Slot {
+        SenderKey key;
+        T value;
+        SlotId prev = NO_SLOT;
+        SlotId next = NO_SLOT; // next in the touch order, or in the free list
+        bool used = false;
+    };
+    Slot m_Slots[Capacity];
+    FlatMap<SenderKey, SlotId, 2 * Capacity> m_Index;
+    SlotId m_FreeList = NO_SLOT;
+    SlotId m_Oldest = NO_SLOT;
+    SlotId m_Newest = NO_SLOT;
+    SlotId m_HighWater = 0; // slots at and above this were never used
+    size_t m_Size = 0;
+
+    void unlink(SlotId id) {
+        Slot& slot = m_Slots[id];
+        (slot.prev != NO_SLOT ? m_Slots[slot.prev].next : m_Oldest) = slot.next;
+        (slot.next != NO_SLOT ? m_Slots[slot.next].prev : m_Newest) = slot.prev;
+    }
+
+    void linkAsNewest(SlotId id) {
+        Slot& slot = m_Slots[id];
+        slot.prev = m_Newest;
+        slot.next = NO_SLOT;
+        (m_Newest != NO_SLOT ? m_Slots[m_Newest].next : m_Oldest) = id;
+        m_Newest = id;
+    }
+
+public:
+    static constexpr size_t capacity() { return Capacity; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+
+    SlotId find(const SenderKey& key) const {
+        const SlotId* slot = m_Index.find(key);
+        return slot ? *slot : NO_SLOT;
+    }
+
+    // Adds a new, default constructed value as the newest one.
+    // Returns NO_SLOT if the table is full.
+    SlotId insert(const SenderKey& key) {
+        SlotId id;
+        if (m_FreeList != NO_SLOT) {
+            id = m_FreeList;
+            m_FreeList = m_Slots[id].next;
+        } else if (m_HighWater < Capacity) {
+            id = m_HighWater++;
+        } else {
+            return NO_SLOT;
+        }
+        m_Index.insert(key, id);
+        Slot& slot = m_Slots[id];
+        slot.key = key;
+        slot.value = T();
+        slot.used = true;
+        linkAsNewest(id);
+        ++m_Size;
+        return id;
+    }
+
+    void erase(SlotId id) {
+        Slot& slot = m_Slots[id];
+        m_Index.erase(slot.key);
+        unlink(id);
+        slot.used = false;
+        slot.next = m_FreeList;
+        m_FreeList = id;
+        --m_Size;
+    }
+
+    // Moves the slot to the end of the touch order
+    void touch(SlotId id) {
+        if (id != m_Newest) {
+            unlink(id);
+            linkAsNewest(id);
+        }
+    }
+
+    // Least recently touched slot, NO_SLOT if the table is empty
+    SlotId oldest() const { return m_Oldest; }
+    SlotId newer(SlotId id) const { return m_Slots[id].next; }
+
+    T& operator[](SlotId id) { return m_Slots[id].value; }
+    const T& operator[](SlotId id) const { return m_Slots[id].value; }
+    const SenderKey& keyOf(SlotId id) const { return m_Slots[id].key; }
+
+    template<class Fn>
+    void forEach(Fn fn) const {
+        for (SlotId id = 0; id < m_HighWater; ++id) {
+            if (m_Slots[id].used) {
+                fn(m_Slots[id].value);
+            }
+        }
+    }
+};
+
+template<class T, size_t Capacity>
+constexpr typename ClientTable<T, Capacity>::SlotId ClientTable<T, Capacity>::NO_SLOT;
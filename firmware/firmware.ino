@@ -7,8 +7,14 @@
 #include <ESP8266mDNS.h>
 #include <TM1637Display.h>
 
+// Log messages go to the serial port as binary tokens (decode them with logdecode.py),
+// packet dumps would still slow the loop down
+#define CHECKMEET_LOG_LEVEL CHECKMEET_LOG_LEVEL_INFO
+#define CHECKMEET_LOG_TOKENIZED
 #include "lib_firmware.h"
+#include "logring.h"
 #include "serialnames.h"
+#include "shadowdevice.h"
 
 class Device : public I_Device {
   static constexpr int NUM_LEDS = 6;
@@ -19,6 +25,10 @@ class Device : public I_Device {
   static constexpr int DISPLAY_DIO = D5;
   TM1637Display display{DISPLAY_CLK, DISPLAY_DIO};
 
+  // Serial.printf() blocks once the UART FIFO is full, so log() only buffers
+  // and drainLog() writes as much as the FIFO takes without waiting
+  LogRing<2048> logRing;
+
   CRGB decode(Color color) {
     switch(color) {
       case Color::On: return CRGB::Red;
@@ -37,16 +47,31 @@ class Device : public I_Device {
     }
 
     virtual void log(StringView message) override {
-      Serial.printf("%.*s", static_cast<int>(message.size()), message.data());
+      logRing.append(message);
+    }
+
+    // Returns true if there is still buffered log output
+    bool drainLog() {
+      logRing.drain(Serial.availableForWrite(), [](const char* data, size_t size) {
+        return Serial.write(reinterpret_cast<const uint8_t*>(data), size);
+      });
+      return !logRing.empty();
+    }
+
+    unsigned long droppedLogBytes() const {
+      return logRing.droppedBytes();
     }
 
     virtual void setMicrophoneLeds(Color color) override {
       leds[0] = leds[1] = leds[2] = decode(color);
-      FastLED.show();
     }
 
     virtual void setWebcamLeds(Color color) override {
       leds[3] = leds[4] = leds[5] = decode(color);
+    }
+
+    // FastLED.show() runs with interrupts off, so the strip is pushed once per frame
+    virtual void commitLedFrame() override {
       FastLED.show();
     }
 
@@ -62,24 +87,85 @@ class Device : public I_Device {
 WiFiUDP Udp;
 static const uint16_t localUdpPort = 26999;
 
+// Reads every datagram lwIP has queued, up to one batch per receive() call
+template<size_t BatchSize>
+class UdpTransport : public I_Transport {
+  static constexpr size_t MAX_PACKET = 255;
+  char buffers[BatchSize][MAX_PACKET + 1];
+  I_Device& logDevice;
+
+  public:
+    explicit UdpTransport(I_Device& device) : logDevice(device) {}
+
+    virtual size_t receive(Span<Datagram> batch) override {
+      size_t count = 0;
+      while (count < batch.size() && count < BatchSize) {
+        const int packetSize = Udp.parsePacket();
+        if (!packetSize) {
+          break;
+        }
+        const IPAddress remote = Udp.remoteIP();
+        CHECKMEET_LOG_DEBUG(logDevice, LogToken::UdpReceived, packetSize, LogIPv4{{remote[0], remote[1], remote[2], remote[3]}}, Udp.remotePort());
+        const int len = Udp.read(buffers[count], MAX_PACKET);
+        if (len <= 0) {
+          continue;
+        }
+        buffers[count][len] = 0;
+        batch.data()[count].payload = StringView(buffers[count], len);
+        batch.data()[count].source = Endpoint(static_cast<uint32_t>(Udp.remoteIP()), Udp.remotePort());
+        ++count;
+      }
+      return count;
+    }
+};
+
+// Datagrams handled per loop() iteration, a burst of senders is drained in a few
+// iterations instead of piling up in lwIP's small receive queue
+constexpr size_t UDP_BATCH = 4;
+constexpr size_t UDP_BUDGET = 16;
+
+// Longest time loop() sleeps when idle, this bounds the latency of packets and the button
+constexpr unsigned long MAX_IDLE_MS = 20;
+
+// In light sleep the radio only wakes for DTIM beacons, every 100-300 ms, and the
+// access point holds datagrams back until then. That only pays off while nobody
+// sends: with clients tracked the radio stays awake, so that their changes reach
+// the LEDs within MAX_IDLE_MS, and only the first packet after standby waits.
+static WiFiSleepType_t sleepMode = WIFI_LIGHT_SLEEP;
+
+void updateSleepMode(bool clientsTracked) {
+  const WiFiSleepType_t wanted = clientsTracked ? WIFI_NONE_SLEEP : WIFI_LIGHT_SLEEP;
+  if (wanted != sleepMode) {
+    WiFi.setSleepMode(wanted);
+    sleepMode = wanted;
+  }
+}
+
 constexpr auto PIN_BUTTON = D3;
 static bool button = true;
 
-std::unique_ptr<I_Device> device;
+std::unique_ptr<Device> hardware;
+std::unique_ptr<ShadowDevice> device;
 std::unique_ptr<I_Firmware> firmware;
+std::unique_ptr<UdpTransport<UDP_BATCH>> transport;
 
 void setup() {
-  device = make_unique<Device>();
+  hardware = make_unique<Device>();
+  device = make_unique<ShadowDevice>(*hardware);
   firmware = make_unique<Firmware>(*device);
+  transport = make_unique<UdpTransport<UDP_BATCH>>(*device);
 
   const auto hostname = computeNameForId(ESP.getChipId());
   WiFi.mode(WIFI_STA);
   WiFi.hostname(hostname.c_str());
-  if (WiFiManager().autoConnect(fmt("CheckMeet_%06X", ESP.getChipId()).c_str())) {
+  InlineString<16> accessPointName;
+  fmt(accessPointName, "CheckMeet_%06X", ESP.getChipId());
+  if (WiFiManager().autoConnect(accessPointName.c_str())) {
     Serial.println("Connected \\o/");
   } else {
     Serial.println("Failed to connect :(");
   }
+  WiFi.setSleepMode(sleepMode); // lets the idle delay() in loop() light-sleep between DTIM beacons
   Udp.begin(localUdpPort);
   Serial.printf("Now listening at IP %s, UDP port %d\n", WiFi.localIP().toString().c_str(), localUdpPort);
   pinMode(PIN_BUTTON, INPUT_PULLUP);
@@ -95,29 +181,36 @@ void loop() {
 
   MDNS.update();
 
-  int packetSize = Udp.parsePacket();
-  if (packetSize) {
-    // receive incoming UDP packets
-    Serial.printf("Received %d bytes from %s, port %d\n", packetSize, Udp.remoteIP().toString().c_str(), Udp.remotePort());
-    char incomingPacket[255];
-    int len = Udp.read(incomingPacket, 255);
-    if (len > 0) {
-      incomingPacket[len] = 0;
-    }
-    firmware->udpReceived(now, StringView(incomingPacket, len));
-
-    // send back a reply, to the IP address and port we got the packet from
-    //Udp.beginPacket(Udp.remoteIP(), Udp.remotePort());
-    //Udp.write(replyPacket);
-    //Udp.endPacket();
-  }
+  const size_t received = receiveDatagrams<UDP_BATCH>(*transport, *firmware, now, UDP_BUDGET);
 
   {
     const auto newButton = digitalRead(PIN_BUTTON);
     if (newButton != button) {
       button = newButton;
-      Serial.printf("button goes %d\n", button);
+      logMessage(*device, LogToken::ButtonChanged, button);
+      logMessage(*device, LogToken::HardwareWrites, device->forwardedWrites(), device->suppressedWrites());
+      logMessage(*device, LogToken::LogBytesDropped, hardware->droppedLogBytes());
     }
   }
   firmware->loopEnded(now);
+
+  // Spare time: move buffered log output to the serial port
+  const bool logPending = hardware->drainLog();
+
+  Timestamp deadline;
+  const bool clientsTracked = firmware->nextDeadline(deadline);
+  updateSleepMode(clientsTracked);
+
+  if (!received) {
+    // Nothing to do until a packet arrives or the next client times out,
+    // wake up early if the UART will have room for more log output
+    unsigned long idle = logPending ? 1 : MAX_IDLE_MS;
+    if (clientsTracked) {
+      const long untilDeadline = static_cast<int32_t>(deadline - static_cast<Timestamp>(millis()));
+      idle = untilDeadline > 0 ? std::min<unsigned long>(idle, untilDeadline) : 0;
+    }
+    if (idle) {
+      delay(idle);
+    }
+  }
 }
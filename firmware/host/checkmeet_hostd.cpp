@@ -0,0 +1,372 @@
+// Runs the firmware core on a Linux host: a UDP server aggregating the status
+// of many senders, with the LED and client count state published by HostDevice.
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "clientstore.h"
+#include "hostdevice.h"
+#include "hostloop.h"
+#include "networkthread.h"
+#include "recvmmsgtransport.h"
+#include "shardedhost.h"
+#include "udpsocket.h"
+#include "uringtransport.h"
+
+namespace {
+
+// Datagrams per recvmmsg() call, and per loop iteration before timeouts are checked again
+constexpr size_t RECV_BATCH = 64;
+constexpr size_t LOOP_BUDGET = 1024;
+// Buffers the kernel can fill before the io_uring backend runs out
+constexpr size_t URING_BUFFERS = 1024;
+constexpr long MAX_THREADS = 64;
+// Longest --timeout-ms, a day
+constexpr long MAX_CLIENT_TIMEOUT_MS = 24 * 60 * 60 * 1000L;
+// Datagrams the network thread can be ahead of the firmware
+constexpr size_t HANDOFF_SLOTS = 4096;
+// How often the clients file is brought up to date
+constexpr int CLIENTS_INTERVAL_MS = 1000;
+
+enum class Backend { Epoll, IoUring };
+
+struct Options {
+    uint32_t bindAddress = INADDR_ANY;
+    uint16_t port = 26999;
+    unsigned long clientTimeout_ms = DEFAULT_CLIENT_TIMEOUT_MS;
+    const char* statePath = nullptr;
+    const char* clientsPath = nullptr;
+    Backend backend = Backend::Epoll;
+    size_t threads = 1;
+    bool networkThread = false;
+    bool verbose = false;
+};
+
+void usage(const char* program) {
+    std::fprintf(stderr,
+        "usage: %s [--bind ADDRESS] [--port PORT] [--timeout-ms MS] [--state-file PATH] [--clients-file PATH] [--backend epoll|io_uring] [--threads N | --net-thread] [--verbose]\n"
+        "Prints a JSON line with the LED state and client count on every change.\n", program);
+}
+
+// False unless `value` is a whole decimal number from `min` to `max`
+bool parseNumber(const char* value, long min, long max, long& number) {
+    char* end;
+    errno = 0;
+    number = std::strtol(value, &end, 10);
+    return end != value && !*end && !errno && number >= min && number <= max;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!std::strcmp(arg, "--verbose")) {
+            options.verbose = true;
+        } else if (!std::strcmp(arg, "--net-thread")) {
+            options.networkThread = true;
+        } else if (!std::strcmp(arg, "--bind") && value) {
+            in_addr address;
+            if (inet_pton(AF_INET, value, &address) != 1) {
+                return false;
+            }
+            options.bindAddress = ntohl(address.s_addr);
+            ++i;
+        } else if (!std::strcmp(arg, "--port") && value) {
+            long port;
+            if (!parseNumber(value, 0, 65535, port)) {
+                return false;
+            }
+            options.port = static_cast<uint16_t>(port);
+            ++i;
+        } else if (!std::strcmp(arg, "--timeout-ms") && value) {
+            long timeout_ms;
+            if (!parseNumber(value, 1, MAX_CLIENT_TIMEOUT_MS, timeout_ms)) {
+                return false;
+            }
+            options.clientTimeout_ms = static_cast<unsigned long>(timeout_ms);
+            ++i;
+        } else if (!std::strcmp(arg, "--backend") && value) {
+            if (!std::strcmp(value, "epoll")) {
+                options.backend = Backend::Epoll;
+            } else if (!std::strcmp(value, "io_uring")) {
+                options.backend = Backend::IoUring;
+            } else {
+                return false;
+            }
+            ++i;
+        } else if (!std::strcmp(arg, "--threads") && value) {
+            long threads;
+            if (!parseNumber(value, 1, MAX_THREADS, threads)) {
+                return false;
+            }
+            options.threads = static_cast<size_t>(threads);
+            ++i;
+        } else if (!std::strcmp(arg, "--state-file") && value) {
+            options.statePath = value;
+            ++i;
+        } else if (!std::strcmp(arg, "--clients-file") && value) {
+            options.clientsPath = value;
+            ++i;
+        } else {
+            return false;
+        }
+    }
+    // The shards already receive on threads of their own, and each has its own clients
+    return options.threads == 1 || (!options.networkThread && !options.clientsPath);
+}
+
+// Null if the backend can't be set up
+std::unique_ptr<I_HostTransport> makeTransport(Backend backend, int socketFd) {
+    if (backend == Backend::Epoll) {
+        return make_unique<RecvmmsgTransport<RECV_BATCH>>(socketFd);
+    }
+    std::unique_ptr<UringTransport<URING_BUFFERS>> uring = make_unique<UringTransport<URING_BUFFERS>>(socketFd);
+    if (!uring->ok()) {
+        std::fprintf(stderr, "checkmeet_hostd: cannot set up io_uring: %s\n", std::strerror(uring->error()));
+        return nullptr;
+    }
+    return uring;
+}
+
+const char* backendName(Backend backend) {
+    return backend == Backend::IoUring ? "io_uring" : "epoll";
+}
+
+// The clients as a JSON array, one object per line
+std::string clientsJson(const ClientSnapshot& snapshot) {
+    std::string json("[\n");
+    for (size_t i = 0; i < snapshot.clients.size(); ++i) {
+        const ClientStatus& client = snapshot.clients[i];
+        InlineString<64> source;
+        source.append("null");
+        if (client.source.known()) {
+            fmt(source, "\"%u.%u.%u.%u:%u\"", client.source.ip >> 24, (client.source.ip >> 16) & 0xff,
+                (client.source.ip >> 8) & 0xff, client.source.ip & 0xff, static_cast<unsigned>(client.source.port));
+        }
+        json += fmt(R"(  {"key":"%08x-%04x-%04x-%04x-%012llx","source":%s,"microphone":%s,"webcam":%s,"idle_ms":%u})",
+            static_cast<unsigned>(client.key.hi >> 32), static_cast<unsigned>(client.key.hi >> 16 & 0xffff),
+            static_cast<unsigned>(client.key.hi & 0xffff), static_cast<unsigned>(client.key.lo >> 48),
+            static_cast<unsigned long long>(client.key.lo & 0xffffffffffffULL), source.c_str(),
+            client.microphone ? "true" : "false", client.webcam ? "true" : "false",
+            static_cast<unsigned>(snapshot.taken - client.lastUpdate));
+        json += i + 1 < snapshot.clients.size() ? ",\n" : "\n";
+    }
+    json += "]\n";
+    return json;
+}
+
+// Keeps `path` up to date with the store's latest snapshot until `stopFd` becomes
+// readable. Runs on a thread of its own, so the firmware never waits for the disk.
+void writeClientsFile(ClientStore<1>& store, const std::string& path, int stopFd) {
+    ClientStore<1>::Reader reader(store);
+    uint64_t written = UINT64_MAX;
+    pollfd stop = { stopFd, POLLIN, 0 };
+    do {
+        std::string json;
+        reader.read([&](const ClientSnapshot& snapshot) {
+            if (snapshot.version != written) {
+                written = snapshot.version;
+                json = clientsJson(snapshot);
+            }
+        });
+        if (json.empty()) {
+            continue;
+        }
+        // Replaced atomically, like the state file
+        const std::string temporary = path + ".tmp";
+        if (FILE* file = std::fopen(temporary.c_str(), "w")) {
+            const bool complete = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+            if (std::fclose(file) == 0 && complete) {
+                std::rename(temporary.c_str(), path.c_str());
+            }
+        }
+    } while (poll(&stop, 1, CLIENTS_INTERVAL_MS) == 0);
+}
+
+// One Firmware on the main thread, which also receives unless `--net-thread` is given
+int runSingle(const Options& options, HostDevice& device, int signalFd) {
+    const int socketFd = openUdpSocket(options.bindAddress, options.port);
+    if (socketFd < 0) {
+        std::perror("checkmeet_hostd: cannot open UDP socket");
+        return 1;
+    }
+    // Large tables don't belong on the stack
+    std::unique_ptr<Firmware> firmware = make_unique<Firmware>(device, options.clientTimeout_ms);
+    std::unique_ptr<I_HostTransport> transport = makeTransport(options.backend, socketFd);
+    if (!transport) {
+        close(socketFd);
+        return 1;
+    }
+    std::unique_ptr<NetworkThread<RECV_BATCH, HANDOFF_SLOTS>> network;
+    if (options.networkThread) {
+        network = make_unique<NetworkThread<RECV_BATCH, HANDOFF_SLOTS>>(*transport);
+        if (!network->ok()) {
+            std::perror("checkmeet_hostd: cannot set up the network thread");
+            close(socketFd);
+            return 1;
+        }
+    }
+    I_HostTransport& received = network ? static_cast<I_HostTransport&>(*network) : *transport;
+    HostLoop<RECV_BATCH> loop(*firmware, received, signalFd, LOOP_BUDGET);
+    if (!loop.ok()) {
+        std::perror("checkmeet_hostd: cannot set up epoll");
+        close(socketFd);
+        return 1;
+    }
+    std::fprintf(stderr, "checkmeet_hostd: listening on UDP port %u with %s%s, up to %d clients\n",
+        static_cast<unsigned>(boundPort(socketFd)), backendName(options.backend), network ? " on a network thread" : "", CHECKMEET_MAX_CLIENTS);
+
+    // The clients file is written from snapshots, published at most once per interval
+    std::unique_ptr<ClientStore<1>> clients;
+    int clientsStopFd = -1;
+    std::thread clientsWriter;
+    if (options.clientsPath) {
+        clientsStopFd = eventfd(0, EFD_CLOEXEC);
+        if (clientsStopFd < 0) {
+            std::perror("checkmeet_hostd: cannot set up the clients file");
+            close(socketFd);
+            return 1;
+        }
+        clients = make_unique<ClientStore<1>>();
+        clientsWriter = std::thread(writeClientsFile, std::ref(*clients), std::string(options.clientsPath), clientsStopFd);
+    }
+
+    if (network) {
+        network->start();
+    }
+    // Publishes the initial state
+    loop.runIdle();
+    Timestamp lastPublished = monotonicMillis() - CLIENTS_INTERVAL_MS;
+    while (loop.runOnce(clients ? CLIENTS_INTERVAL_MS : -1)) {
+        const Timestamp now = monotonicMillis();
+        if (clients && static_cast<int32_t>(now - lastPublished) >= CLIENTS_INTERVAL_MS) {
+            clients->publish(now, *firmware);
+            lastPublished = now;
+        }
+    }
+    if (network) {
+        network->stop();
+    }
+    if (clientsWriter.joinable()) {
+        const uint64_t one = 1;
+        ssize_t written = write(clientsStopFd, &one, sizeof(one));
+        (void)written; // the counter can't overflow with a single write
+        clientsWriter.join();
+        close(clientsStopFd);
+    }
+    if (received.lastError()) {
+        std::fprintf(stderr, "checkmeet_hostd: receive: %s\n", std::strerror(received.lastError()));
+    } else if (!loop.stopped()) {
+        std::perror("checkmeet_hostd: epoll_wait");
+    }
+
+    const FirmwareStats& stats = firmware->stats();
+    std::fprintf(stderr, "checkmeet_hostd: %zu datagrams in %zu receive syscalls, %zu oversized, %zu unchanged, %zu superseded, "
+        "%zu rejected by the full client table\n",
+        loop.datagrams(), received.syscalls(), received.truncated(), stats.unchangedPackets, stats.supersededPackets, stats.rejectedPackets);
+    if (network) {
+        std::fprintf(stderr, "checkmeet_hostd: %zu dropped by the full handoff ring, %.2f ms average and %u ms maximum wait in it\n",
+            network->overflows(), network->averageDelay_ms(), static_cast<unsigned>(network->maxDelay_ms()));
+    }
+    network.reset();
+    transport.reset();
+    close(socketFd);
+    return 0;
+}
+
+// A Firmware shard per worker thread, merged into `device` on the main thread
+int runSharded(const Options& options, HostDevice& device, int signalFd) {
+    FILE* const log = options.verbose ? stderr : nullptr;
+    ShardedHost<RECV_BATCH> host(options.threads, options.bindAddress, options.port, options.clientTimeout_ms, log, LOOP_BUDGET,
+        [&options](int socketFd) { return makeTransport(options.backend, socketFd); });
+    if (!host.ok()) {
+        std::fprintf(stderr, "checkmeet_hostd: cannot set up %zu shards: %s\n", options.threads, std::strerror(host.error()));
+        return 1;
+    }
+    const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event events[2] = {};
+    events[0].events = EPOLLIN;
+    events[0].data.fd = signalFd;
+    events[1].events = EPOLLIN;
+    events[1].data.fd = host.mergeFd();
+    if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &events[0]) < 0
+            || epoll_ctl(epollFd, EPOLL_CTL_ADD, host.mergeFd(), &events[1]) < 0) {
+        std::perror("checkmeet_hostd: cannot set up epoll");
+        if (epollFd >= 0) {
+            close(epollFd);
+        }
+        return 1;
+    }
+    std::fprintf(stderr, "checkmeet_hostd: listening on UDP port %u with %s, %zu threads, up to %d clients each\n",
+        static_cast<unsigned>(host.port()), backendName(options.backend), host.shards(), CHECKMEET_MAX_CLIENTS);
+
+    host.start();
+    bool running = true;
+    while (running) {
+        const int ready = epoll_wait(epollFd, events, 2, -1);
+        if (ready < 0 && errno != EINTR) {
+            std::perror("checkmeet_hostd: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < ready; ++i) {
+            if (events[i].data.fd == signalFd) {
+                running = false;
+            } else {
+                host.merge(device);
+            }
+        }
+        if (host.failed()) {
+            std::fprintf(stderr, "checkmeet_hostd: a shard stopped after an error\n");
+            break;
+        }
+    }
+    host.stop();
+    close(epollFd);
+
+    const ShardedStats stats = host.stats();
+    std::fprintf(stderr, "checkmeet_hostd: %zu datagrams in %zu receive syscalls, %zu oversized, %zu forwarded between threads, "
+        "%zu dropped by full mailboxes, %zu unchanged, %zu superseded, %zu rejected by full client tables\n",
+        stats.datagrams, stats.syscalls, stats.truncated, stats.forwarded, stats.dropped, stats.unchangedPackets, stats.supersededPackets,
+        stats.rejectedPackets);
+    return 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // SIGINT and SIGTERM are read from a descriptor, so shutdown happens between packets.
+    // Blocked before any worker thread starts, so that they inherit the mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    const int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd < 0) {
+        std::perror("checkmeet_hostd: cannot set up signalfd");
+        return 1;
+    }
+
+    HostDevice device(stdout, options.verbose ? stderr : nullptr, options.statePath ? options.statePath : "");
+    const int status = options.threads > 1 ? runSharded(options, device, signalFd) : runSingle(options, device, signalFd);
+    close(signalFd);
+    return status;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "lib_firmware.h"
+
+// The client table as it was at one point, never modified while readers can see it
+struct ClientSnapshot {
+    uint64_t version = 0; // counts up with every publish()
+    Timestamp taken = 0;
+    std::vector<ClientStatus> clients; // least recently updated first
+    size_t microphones = 0;
+    size_t webcams = 0;
+};
+
+// Copies of Firmware's client table for other threads, e.g. monitoring, while
+// the firmware's thread keeps applying packets. That thread is the only writer:
+// publish() fills a new snapshot and swaps it in. Readers never block it, nor
+// each other: a read announces the current epoch in the reader's own slot and
+// picks up the latest snapshot. A replaced snapshot is reused once every reader
+// that could still see it has finished, which the writer learns from the slots.
+// It never waits for that, a slow reader only keeps more snapshots around.
+template<size_t MaxReaders>
+class ClientStore {
+    static constexpr size_t CACHE_LINE = 64;
+
+    // 0 while the reader isn't reading
+    struct ReaderSlot {
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> claimed{false};
+        char pad[CACHE_LINE - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>)];
+    };
+
+    struct Retired {
+        std::unique_ptr<ClientSnapshot> snapshot;
+        uint64_t epoch; // readers that announced an earlier one may still see it
+    };
+
+    std::atomic<ClientSnapshot*> m_Current{nullptr};
+    std::atomic<uint64_t> m_Epoch{1};
+    ReaderSlot m_Readers[MaxReaders];
+
+    // Writer only
+    std::vector<Retired> m_Retired;
+    std::vector<std::unique_ptr<ClientSnapshot>> m_Spare;
+    uint64_t m_Version = 0;
+
+    // Moves the retired snapshots no reader can see anymore to the spares
+    void reclaim() {
+        uint64_t oldestReader = UINT64_MAX;
+        for (const ReaderSlot& reader : m_Readers) {
+            const uint64_t epoch = reader.epoch.load();
+            if (epoch && epoch < oldestReader) {
+                oldestReader = epoch;
+            }
+        }
+        size_t kept = 0;
+        for (Retired& retired : m_Retired) {
+            if (retired.epoch <= oldestReader) {
+                m_Spare.push_back(std::move(retired.snapshot));
+            } else {
+                m_Retired[kept++] = std::move(retired);
+            }
+        }
+        m_Retired.resize(kept);
+    }
+
+    void swapIn(std::unique_ptr<ClientSnapshot> next) {
+        ClientSnapshot* const previous = m_Current.exchange(next.release());
+        // Readers announcing this epoch or a later one load the new snapshot
+        const uint64_t epoch = m_Epoch.fetch_add(1) + 1;
+        if (previous) {
+            m_Retired.push_back(Retired{std::unique_ptr<ClientSnapshot>(previous), epoch});
+        }
+    }
+
+public:
+    // A reader thread's handle. Reads must not nest.
+    class Reader {
+        ClientStore& m_Store;
+        ReaderSlot* m_Slot = nullptr;
+
+    public:
+        explicit Reader(ClientStore& store) : m_Store(store) {
+            for (ReaderSlot& slot : store.m_Readers) {
+                bool claimed = false;
+                if (slot.claimed.compare_exchange_strong(claimed, true)) {
+                    m_Slot = &slot;
+                    return;
+                }
+            }
+        }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        ~Reader() {
+            if (m_Slot) {
+                m_Slot->claimed = false;
+            }
+        }
+
+        // False if all MaxReaders slots are taken
+        bool ok() const { return m_Slot != nullptr; }
+
+        // Calls `fn` with the latest snapshot, which stays valid until `fn` returns.
+        // Returns false without calling it if the reader got no slot.
+        template<class Fn>
+        bool read(Fn fn) {
+            if (!m_Slot) {
+                return false;
+            }
+            m_Slot->epoch.store(m_Store.m_Epoch.load());
+            const ClientSnapshot& snapshot = *m_Store.m_Current.load();
+            fn(snapshot);
+            m_Slot->epoch.store(0, std::memory_order_release);
+            return true;
+        }
+    };
+
+    // Starts with an empty snapshot
+    ClientStore() {
+        swapIn(make_unique<ClientSnapshot>());
+    }
+
+    ClientStore(const ClientStore&) = delete;
+    ClientStore& operator=(const ClientStore&) = delete;
+
+    // All readers must be gone
+    ~ClientStore() {
+        delete m_Current.load();
+    }
+
+    // Writer: publishes the firmware's current clients. Doesn't allocate once
+    // the spare snapshots have grown to the table's size.
+    void publish(Timestamp now, const Firmware& firmware) {
+        reclaim();
+        std::unique_ptr<ClientSnapshot> next;
+        if (m_Spare.empty()) {
+            next = make_unique<ClientSnapshot>();
+        } else {
+            next = std::move(m_Spare.back());
+            m_Spare.pop_back();
+        }
+        next->version = ++m_Version;
+        next->taken = now;
+        next->clients.clear();
+        next->microphones = 0;
+        next->webcams = 0;
+        firmware.forEachClient([&](const ClientStatus& client) {
+            next->clients.push_back(client);
+            next->microphones += client.microphone;
+            next->webcams += client.webcam;
+        });
+        swapIn(std::move(next));
+    }
+
+    // Writer: replaced snapshots that readers may still see, and ones ready for reuse
+    size_t retired() const { return m_Retired.size(); }
+    size_t spare() const { return m_Spare.size(); }
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "hosttransport.h"
+
+// Queue of datagrams between one producer and one consumer thread, in
+// preallocated slots, so neither side ever allocates or waits for the other.
+// When the ring is full the producer drops the datagram and counts an overflow.
+// The consumer reads datagrams in place and releases their slots when done.
+template<size_t Capacity>
+class DatagramRing {
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "Capacity must be a power of two");
+
+public:
+    struct Slot {
+        Timestamp received; // when the producer got the datagram
+        Endpoint source;
+        uint16_t size;
+        char payload[I_HostTransport::MAX_PACKET];
+
+        Datagram datagram() const { return Datagram{StringView(payload, size), source}; }
+    };
+
+private:
+    // Each index is written by one side only. They start cache lines of their
+    // own, with the side's copy of the other index next to its own, and so do
+    // the slots.
+    static constexpr size_t CACHE_LINE = 64;
+
+    alignas(CACHE_LINE) std::atomic<size_t> m_Tail{0}; // next slot to write
+    size_t m_CachedHead = 0;
+    std::atomic<size_t> m_Overflows{0};
+
+    alignas(CACHE_LINE) std::atomic<size_t> m_Head{0}; // next slot to release
+    size_t m_CachedTail = 0;
+
+    alignas(CACHE_LINE) Slot m_Slots[Capacity];
+
+public:
+    // operator new only aligns to 16 bytes before C++17
+    static void* operator new(size_t size) {
+        void* memory;
+        if (posix_memalign(&memory, CACHE_LINE, size)) {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+    static void operator delete(void* memory) { std::free(memory); }
+
+    // Producer: copies the datagram into the next free slot. Returns false if the
+    // ring is full or the payload doesn't fit a slot.
+    bool push(Timestamp received, const Endpoint& source, StringView payload) {
+        const size_t tail = m_Tail.load(std::memory_order_relaxed);
+        if (payload.size() > I_HostTransport::MAX_PACKET) {
+            return false;
+        }
+        if (tail - m_CachedHead == Capacity) {
+            m_CachedHead = m_Head.load(std::memory_order_acquire);
+            if (tail - m_CachedHead == Capacity) {
+                // Only the producer writes the counter, no read-modify-write is needed
+                m_Overflows.store(m_Overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        Slot& slot = m_Slots[tail & (Capacity - 1)];
+        slot.received = received;
+        slot.source = source;
+        slot.size = static_cast<uint16_t>(payload.size());
+        std::memcpy(slot.payload, payload.data(), payload.size());
+        m_Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: the number of unreleased datagrams. May lag behind the producer
+    // until the ones seen before are released.
+    size_t available() {
+        const size_t head = m_Head.load(std::memory_order_relaxed);
+        if (m_CachedTail == head) {
+            m_CachedTail = m_Tail.load(std::memory_order_acquire);
+        }
+        return m_CachedTail - head;
+    }
+
+    // Consumer: the `index`th unreleased datagram
+    const Slot& at(size_t index) const {
+        return m_Slots[(m_Head.load(std::memory_order_relaxed) + index) & (Capacity - 1)];
+    }
+
+    // Consumer: hands the oldest `count` slots back to the producer
+    void release(size_t count) {
+        m_Head.store(m_Head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Datagrams dropped because the ring was full, counted by the producer and
+    // readable from either thread
+    size_t overflows() const { return m_Overflows.load(std::memory_order_relaxed); }
+};
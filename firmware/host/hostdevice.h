@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <utility>
+
+#include "lib_firmware.h"
+
+inline const char* colorName(Color color) {
+    switch (color) {
+        case Color::On: return "on";
+        case Color::Off: return "off";
+        case Color::Standby: return "standby";
+        case Color::Initializing: return "initializing";
+    }
+    return "unknown";
+}
+
+// Software stand-in for the LEDs and the display. Changes are published when
+// the display is updated, i.e. once per loop, as one JSON line on `out` and, if
+// a path is given, as the whole content of that file. The file is replaced
+// atomically so readers never see a partial state.
+class HostDevice : public I_Device {
+    FILE* m_Out;
+    FILE* m_Log;
+    std::string m_StatePath;
+
+    Color m_Microphone = Color::Initializing;
+    Color m_Webcam = Color::Initializing;
+    int m_Clients = 0;
+    bool m_Changed = true;
+    size_t m_Published = 0;
+
+    void publish() {
+        InlineString<128> state;
+        fmt(state, R"({"microphone":"%s","webcam":"%s","clients":%d})" "\n", colorName(m_Microphone), colorName(m_Webcam), m_Clients);
+        if (m_Out) {
+            std::fwrite(state.data(), 1, state.size(), m_Out);
+            std::fflush(m_Out);
+        }
+        if (!m_StatePath.empty()) {
+            const std::string temporary = m_StatePath + ".tmp";
+            if (FILE* file = std::fopen(temporary.c_str(), "w")) {
+                const bool written = std::fwrite(state.data(), 1, state.size(), file) == state.size();
+                if (std::fclose(file) == 0 && written) {
+                    std::rename(temporary.c_str(), m_StatePath.c_str());
+                }
+            }
+        }
+        ++m_Published;
+    }
+
+public:
+    // `log` may be null to drop log messages without formatting them
+    HostDevice(FILE* out, FILE* log, std::string statePath = std::string())
+        : m_Out(out)
+        , m_Log(log)
+        , m_StatePath(std::move(statePath))
+    {}
+
+    virtual void log(StringView message) override {
+        if (m_Log) {
+            std::fwrite(message.data(), 1, message.size(), m_Log);
+        }
+    }
+
+    virtual bool logEnabled() const override { return m_Log != nullptr; }
+
+    virtual void setMicrophoneLeds(Color color) override { m_Microphone = color; }
+    virtual void setWebcamLeds(Color color) override { m_Webcam = color; }
+    virtual void commitLedFrame() override { m_Changed = true; }
+
+    virtual void displayNumber(int number) override {
+        if (number != m_Clients || m_Changed) {
+            m_Clients = number;
+            m_Changed = false;
+            publish();
+        }
+    }
+
+    Color microphone() const { return m_Microphone; }
+    Color webcam() const { return m_Webcam; }
+    int clients() const { return m_Clients; }
+    size_t published() const { return m_Published; }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "hosttransport.h"
+
+inline Timestamp monotonicMillis() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<Timestamp>(static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec) / 1000000);
+}
+
+// The host's equivalent of the sketch's loop(): sleeps in epoll_wait() until the
+// transport has datagrams or a client times out, then runs one firmware loop and
+// hands it the received datagrams.
+template<size_t MaxBatch>
+class HostLoop {
+    I_Firmware& m_Firmware;
+    I_HostTransport& m_Transport;
+    const int m_StopFd;
+    const size_t m_Budget;
+    int m_Epoll;
+    size_t m_Datagrams = 0;
+    bool m_Stopped = false;
+
+    bool watch(int fd) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        return epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    // Milliseconds until the firmware has work without new packets, -1 for none
+    int timeout(Timestamp now) const {
+        Timestamp deadline;
+        if (!m_Firmware.nextDeadline(deadline)) {
+            return -1;
+        }
+        const int32_t remaining = static_cast<int32_t>(deadline - now);
+        return remaining > 0 ? remaining : 0;
+    }
+
+public:
+    // `stopFd` (if not -1) becomes readable when the loop should end.
+    // `budget` limits the datagrams per loop.
+    HostLoop(I_Firmware& firmware, I_HostTransport& transport, int stopFd, size_t budget)
+        : m_Firmware(firmware)
+        , m_Transport(transport)
+        , m_StopFd(stopFd)
+        , m_Budget(budget)
+        , m_Epoll(epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (m_Epoll >= 0 && (!watch(transport.readableFd()) || (stopFd >= 0 && !watch(stopFd)))) {
+            close(m_Epoll);
+            m_Epoll = -1;
+        }
+    }
+
+    HostLoop(const HostLoop&) = delete;
+    HostLoop& operator=(const HostLoop&) = delete;
+
+    ~HostLoop() {
+        if (m_Epoll >= 0) {
+            close(m_Epoll);
+        }
+    }
+
+    bool ok() const { return m_Epoll >= 0; }
+    size_t datagrams() const { return m_Datagrams; }
+    // Whether runOnce() returned false because `stopFd` became readable
+    bool stopped() const { return m_Stopped; }
+
+    // Runs loopStarted() and loopEnded() without waiting, e.g. to publish the initial state
+    void runIdle() {
+        const Timestamp now = monotonicMillis();
+        m_Firmware.loopStarted(now);
+        m_Firmware.loopEnded(now);
+    }
+
+    // One loop, waiting at most `maxWait_ms` (-1: until there is work).
+    // Returns false when stopped, or if epoll or the transport fails.
+    bool runOnce(int maxWait_ms = -1) {
+        int wait_ms = timeout(monotonicMillis());
+        if (maxWait_ms >= 0 && (wait_ms < 0 || wait_ms > maxWait_ms)) {
+            wait_ms = maxWait_ms;
+        }
+        epoll_event events[2];
+        const int ready = epoll_wait(m_Epoll, events, 2, wait_ms);
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+        const Timestamp now = monotonicMillis();
+        m_Firmware.loopStarted(now);
+        for (int i = 0; i < ready; ++i) {
+            if (events[i].data.fd == m_StopFd) {
+                m_Stopped = true;
+            } else if (events[i].data.fd == m_Transport.readableFd()) {
+                m_Datagrams += receiveDatagrams<MaxBatch>(m_Transport, m_Firmware, now, m_Budget);
+            }
+        }
+        m_Firmware.loopEnded(now);
+        return !m_Stopped && !m_Transport.lastError();
+    }
+};
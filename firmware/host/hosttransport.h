@@ -0,0 +1,19 @@
+#pragma once
+
+#include "lib_firmware.h"
+
+// Common interface of the host's receive backends
+class I_HostTransport : public I_Transport {
+public:
+    // The device's receive buffer. The device hands longer datagrams on cut to
+    // this size, which no valid status message survives; the host drops them.
+    static constexpr size_t MAX_PACKET = 255;
+
+    // Becomes readable when receive() has datagrams to return
+    virtual int readableFd() const = 0;
+    virtual size_t syscalls() const = 0;
+    // Datagrams dropped for being longer than MAX_PACKET
+    virtual size_t truncated() const = 0;
+    // errno of the last failed receive, other than having nothing to read
+    virtual int lastError() const = 0;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "datagramring.h"
+#include "hostloop.h"
+
+// Reads a transport on a thread of its own and hands the datagrams through a
+// DatagramRing to the thread running Firmware, e.g. with HostLoop, for which
+// this is the transport. Receiving never waits for the firmware or the device:
+// when the firmware falls behind by more than Capacity datagrams, new ones are
+// dropped and counted in overflows().
+template<size_t BatchSize, size_t Capacity>
+class NetworkThread : public I_HostTransport {
+    I_HostTransport& m_Network;
+    std::unique_ptr<DatagramRing<Capacity>> m_Ring;
+    // Written by the network thread when the ring has new datagrams
+    const int m_WakeFd;
+    const int m_StopFd;
+    std::thread m_Thread;
+    std::atomic<int> m_LastError{0};
+
+    // Logic thread only
+    size_t m_Lent = 0;
+    size_t m_Syscalls = 0;
+    Timestamp m_MaxDelay_ms = 0;
+    uint64_t m_TotalDelay_ms = 0;
+    size_t m_Handed = 0;
+
+    static void signal(int fd) {
+        const uint64_t one = 1;
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void)written; // only fails if the counter is about to overflow, i.e. already set
+    }
+
+    void run() {
+        const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event events[2] = {};
+        events[0].events = EPOLLIN;
+        events[0].data.fd = m_Network.readableFd();
+        events[1].events = EPOLLIN;
+        events[1].data.fd = m_StopFd;
+        if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, m_Network.readableFd(), &events[0]) < 0
+                || epoll_ctl(epollFd, EPOLL_CTL_ADD, m_StopFd, &events[1]) < 0) {
+            stopWith(errno, epollFd);
+            return;
+        }
+        Datagram batch[BatchSize];
+        for (;;) {
+            const int ready = epoll_wait(epollFd, events, 2, -1);
+            if (ready < 0 && errno != EINTR) {
+                stopWith(errno, epollFd);
+                return;
+            }
+            for (int i = 0; i < ready; ++i) {
+                if (events[i].data.fd == m_StopFd) {
+                    close(epollFd);
+                    return;
+                }
+            }
+            size_t received;
+            while ((received = m_Network.receive(Span<Datagram>(batch, BatchSize))) > 0) {
+                const Timestamp now = monotonicMillis();
+                bool pushed = false;
+                for (size_t i = 0; i < received; ++i) {
+                    pushed = m_Ring->push(now, batch[i].source, batch[i].payload) || pushed;
+                }
+                if (pushed) {
+                    signal(m_WakeFd);
+                }
+            }
+            if (m_Network.lastError()) {
+                stopWith(m_Network.lastError(), epollFd);
+                return;
+            }
+        }
+    }
+
+    // Hands the error to the logic thread, which stops its loop
+    void stopWith(int error, int epollFd) {
+        if (epollFd >= 0) {
+            close(epollFd);
+        }
+        m_LastError = error ? error : EIO;
+        signal(m_WakeFd);
+    }
+
+    size_t readRing(Span<Datagram> batch) {
+        const size_t available = m_Ring->available();
+        m_Lent = available < batch.size() ? available : batch.size();
+        if (!m_Lent) {
+            return 0;
+        }
+        const Timestamp now = monotonicMillis();
+        for (size_t i = 0; i < m_Lent; ++i) {
+            const typename DatagramRing<Capacity>::Slot& slot = m_Ring->at(i);
+            batch.data()[i] = slot.datagram();
+            const Timestamp delay = now - slot.received;
+            m_MaxDelay_ms = delay > m_MaxDelay_ms ? delay : m_MaxDelay_ms;
+            m_TotalDelay_ms += delay;
+        }
+        m_Handed += m_Lent;
+        return m_Lent;
+    }
+
+public:
+    // `network` is only used by the network thread from start() to stop()
+    explicit NetworkThread(I_HostTransport& network)
+        : m_Network(network)
+        , m_Ring(make_unique<DatagramRing<Capacity>>())
+        , m_WakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        , m_StopFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {}
+
+    NetworkThread(const NetworkThread&) = delete;
+    NetworkThread& operator=(const NetworkThread&) = delete;
+
+    virtual ~NetworkThread() {
+        stop();
+        if (m_WakeFd >= 0) {
+            close(m_WakeFd);
+        }
+        if (m_StopFd >= 0) {
+            close(m_StopFd);
+        }
+    }
+
+    bool ok() const { return m_WakeFd >= 0 && m_StopFd >= 0; }
+
+    void start() {
+        if (ok() && !m_Thread.joinable()) {
+            m_Thread = std::thread([this] { run(); });
+        }
+    }
+
+    void stop() {
+        if (m_Thread.joinable()) {
+            signal(m_StopFd);
+            m_Thread.join();
+        }
+    }
+
+    // Logic thread: the datagrams in the ring, which stay there until the next call
+    virtual size_t receive(Span<Datagram> batch) override {
+        m_Ring->release(m_Lent);
+        m_Lent = 0;
+        if (!batch.size()) {
+            return 0;
+        }
+        if (const size_t count = readRing(batch)) {
+            return count;
+        }
+        // Before going idle the wakeup is reset, then the ring is read once more
+        // for datagrams that arrived in between
+        uint64_t wakes;
+        ++m_Syscalls;
+        ssize_t read_ = read(m_WakeFd, &wakes, sizeof(wakes));
+        (void)read_; // EAGAIN if it wasn't set
+        return readRing(batch);
+    }
+
+    virtual int readableFd() const override { return m_WakeFd; }
+    // Includes the network transport's, read them after stop()
+    virtual size_t syscalls() const override { return m_Network.syscalls() + m_Syscalls; }
+    virtual size_t truncated() const override { return m_Network.truncated(); }
+    virtual int lastError() const override { return m_LastError; }
+
+    // Datagrams dropped because the firmware fell behind
+    size_t overflows() const { return m_Ring->overflows(); }
+    // Time the datagrams handed to the firmware spent in the ring
+    Timestamp maxDelay_ms() const { return m_MaxDelay_ms; }
+    double averageDelay_ms() const { return m_Handed ? static_cast<double>(m_TotalDelay_ms) / m_Handed : 0.0; }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "hosttransport.h"
+
+// Reads up to BatchSize datagrams per recvmmsg() call from a non-blocking UDP
+// socket, for use with epoll. Datagrams are copied into the transport's buffers.
+template<size_t BatchSize>
+class RecvmmsgTransport : public I_HostTransport {
+    int m_Fd;
+    char m_Buffers[BatchSize][MAX_PACKET + 1];
+    iovec m_Vectors[BatchSize];
+    sockaddr_in m_Sources[BatchSize];
+    mmsghdr m_Headers[BatchSize];
+    size_t m_Syscalls = 0;
+    size_t m_Truncated = 0;
+    int m_LastError = 0;
+
+public:
+    explicit RecvmmsgTransport(int fd) : m_Fd(fd) {
+        std::memset(m_Headers, 0, sizeof(m_Headers));
+        for (size_t i = 0; i < BatchSize; ++i) {
+            // one byte more than accepted, to detect oversized datagrams
+            m_Vectors[i].iov_base = m_Buffers[i];
+            m_Vectors[i].iov_len = MAX_PACKET + 1;
+            m_Headers[i].msg_hdr.msg_iov = &m_Vectors[i];
+            m_Headers[i].msg_hdr.msg_iovlen = 1;
+            m_Headers[i].msg_hdr.msg_name = &m_Sources[i];
+        }
+    }
+
+    virtual size_t receive(Span<Datagram> batch) override {
+        const size_t wanted = std::min(batch.size(), BatchSize);
+        for (size_t i = 0; i < wanted; ++i) {
+            m_Headers[i].msg_hdr.msg_namelen = sizeof(m_Sources[i]);
+        }
+        // A batch of only oversized datagrams doesn't mean the socket is drained
+        for (;;) {
+            ++m_Syscalls;
+            const int received = recvmmsg(m_Fd, m_Headers, static_cast<unsigned>(wanted), MSG_DONTWAIT, nullptr);
+            if (received < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    m_LastError = errno;
+                }
+                return 0;
+            }
+            size_t count = 0;
+            for (int i = 0; i < received; ++i) {
+                const mmsghdr& header = m_Headers[i];
+                if (header.msg_len > MAX_PACKET || (header.msg_hdr.msg_flags & MSG_TRUNC)) {
+                    ++m_Truncated;
+                    continue;
+                }
+                Datagram& datagram = batch.data()[count++];
+                datagram.payload = StringView(m_Buffers[i], header.msg_len);
+                datagram.source = Endpoint(ntohl(m_Sources[i].sin_addr.s_addr), ntohs(m_Sources[i].sin_port));
+            }
+            if (count || !received) {
+                return count;
+            }
+        }
+    }
+
+    virtual int readableFd() const override { return m_Fd; }
+    virtual size_t syscalls() const override { return m_Syscalls; }
+    virtual size_t truncated() const override { return m_Truncated; }
+    virtual int lastError() const override { return m_LastError; }
+};
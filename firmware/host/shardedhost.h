@@ -0,0 +1,548 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "datagramring.h"
+#include "hostloop.h"
+#include "udpsocket.h"
+
+// Shard a sender belongs to. Uses the high bits of the hash, since the shard's
+// client table picks buckets with the low ones.
+inline size_t shardOf(const SenderKey& key, size_t shards) {
+    return static_cast<size_t>((static_cast<uint64_t>(key.hash()) * shards) >> 32);
+}
+
+// Rings between every pair of shards (and from each shard to itself, for split
+// batch frames) and an eventfd per shard to wake it up when it has mail
+class ShardMailboxes {
+public:
+    static constexpr size_t SLOTS = 512;
+    using Ring = DatagramRing<SLOTS>;
+
+private:
+    const size_t m_Shards;
+    std::vector<std::unique_ptr<Ring>> m_Rings;
+    std::vector<int> m_WakeFds;
+
+public:
+    explicit ShardMailboxes(size_t shards) : m_Shards(shards) {
+        for (size_t i = 0; i < shards * shards; ++i) {
+            m_Rings.push_back(make_unique<Ring>());
+        }
+        for (size_t i = 0; i < shards; ++i) {
+            m_WakeFds.push_back(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+        }
+    }
+
+    ShardMailboxes(const ShardMailboxes&) = delete;
+    ShardMailboxes& operator=(const ShardMailboxes&) = delete;
+
+    ~ShardMailboxes() {
+        for (int fd : m_WakeFds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    bool ok() const { return std::none_of(m_WakeFds.begin(), m_WakeFds.end(), [](int fd) { return fd < 0; }); }
+    size_t shards() const { return m_Shards; }
+    Ring& ring(size_t from, size_t to) { return *m_Rings[from * m_Shards + to]; }
+    int wakeFd(size_t shard) const { return m_WakeFds[shard]; }
+
+    void wake(size_t shard) {
+        const uint64_t one = 1;
+        ssize_t written = write(m_WakeFds[shard], &one, sizeof(one));
+        (void)written; // only fails if the counter is about to overflow, i.e. already set
+    }
+
+    // Resets the shard's eventfd
+    void clear(size_t shard) {
+        uint64_t wakes;
+        ssize_t read_ = read(m_WakeFds[shard], &wakes, sizeof(wakes));
+        (void)read_; // EAGAIN if it wasn't set
+    }
+};
+
+// The transport of one shard: reads the shard's SO_REUSEPORT socket, keeps the
+// datagrams of its own senders and forwards the others to their shard's
+// mailbox, then hands out what the other shards forwarded to it. The kernel
+// spreads datagrams by source address, while a sender may move between
+// addresses and a relay speaks for senders of every shard.
+template<size_t BatchSize>
+class ShardTransport : public I_HostTransport {
+    // route() result for a batch frame whose entries belong to several shards
+    static constexpr size_t MIXED = ~size_t(0);
+
+    const size_t m_Shard;
+    I_HostTransport& m_Socket;
+    ShardMailboxes& m_Mailboxes;
+    StatusParser m_Parser;
+    Datagram m_Received[BatchSize];
+    // Per source shard, the slots handed out by the last receive()
+    std::vector<size_t> m_Lent;
+    // Per destination shard, whether it got mail during this receive()
+    std::vector<char> m_Mailed;
+    int m_Epoll;
+    size_t m_Syscalls = 0;
+    size_t m_Forwarded = 0;
+
+    size_t route(const Datagram& datagram) {
+        const size_t shards = m_Mailboxes.shards();
+        StatusMessage message;
+        size_t count = 0;
+        if (!StatusParser::checkBatchFrame(datagram.payload, count)) {
+            size_t shard = 0;
+            for (size_t i = 0; i < count; ++i) {
+                StatusParser::decodeBatchEntry(datagram.payload, i, message);
+                const size_t entryShard = shardOf(message.senderUuid, shards);
+                if (i && entryShard != shard) {
+                    return MIXED;
+                }
+                shard = entryShard;
+            }
+            return shard;
+        }
+        SenderKey key;
+        if (peekSenderKey(datagram, key)) {
+            return shardOf(key, shards);
+        }
+        // Whoever received an invalid datagram logs it
+        if (m_Parser.parse(datagram.payload, message)) {
+            return m_Shard;
+        }
+        return shardOf(Firmware::senderKey(datagram.source, message), shards);
+    }
+
+    // The key of the sender for the forms senders normally use, without a full
+    // parse that the owning shard's Firmware would repeat: a v2 frame, or JSON in
+    // the exact layout StatusParser reads without its general parser. Anywhere
+    // else a "senderId" may not be the field Firmware would use, so that's false.
+    static bool peekSenderKey(const Datagram& datagram, SenderKey& key) {
+        StatusMessage message;
+        if (StatusParser::isFrame(datagram.payload)) {
+            if (StatusParser::decodeFrame(datagram.payload, message)) {
+                return false;
+            }
+        } else if (!StatusParser::parseMinified(datagram.payload, message)) {
+            return false;
+        }
+        key = Firmware::senderKey(datagram.source, message);
+        return true;
+    }
+
+    void forward(size_t shard, Timestamp received, const Datagram& datagram) {
+        if (m_Mailboxes.ring(m_Shard, shard).push(received, datagram.source, datagram.payload)) {
+            ++m_Forwarded;
+            m_Mailed[shard] = true;
+        }
+    }
+
+    // Sends each shard a batch frame with just its senders' entries
+    void split(Timestamp received, const Datagram& frame) {
+        const size_t count = static_cast<uint8_t>(frame.payload.data()[StatusFrame::HEADER_SIZE]);
+        size_t shards[StatusFrame::MAX_BATCH_ENTRIES];
+        for (size_t i = 0; i < count; ++i) {
+            StatusMessage message;
+            StatusParser::decodeBatchEntry(frame.payload, i, message);
+            shards[i] = shardOf(message.senderUuid, m_Mailboxes.shards());
+        }
+        bool done[StatusFrame::MAX_BATCH_ENTRIES] = {};
+        for (size_t i = 0; i < count; ++i) {
+            if (done[i]) {
+                continue;
+            }
+            char part[StatusFrame::BATCH_HEADER_SIZE + StatusFrame::MAX_BATCH_ENTRIES * StatusFrame::BATCH_ENTRY_SIZE];
+            std::memcpy(part, frame.payload.data(), StatusFrame::HEADER_SIZE);
+            size_t entries = 0;
+            for (size_t j = i; j < count; ++j) {
+                if (shards[j] == shards[i]) {
+                    const StringView entry = StatusParser::batchEntry(frame.payload, j);
+                    std::memcpy(part + StatusFrame::BATCH_HEADER_SIZE + entries++ * StatusFrame::BATCH_ENTRY_SIZE, entry.data(), entry.size());
+                    done[j] = true;
+                }
+            }
+            part[StatusFrame::HEADER_SIZE] = static_cast<char>(entries);
+            forward(shards[i], received, Datagram{StringView(part, StatusFrame::BATCH_HEADER_SIZE + entries * StatusFrame::BATCH_ENTRY_SIZE), frame.source});
+        }
+    }
+
+    size_t readMailboxes(Span<Datagram> batch, size_t count) {
+        for (size_t from = 0; from < m_Mailboxes.shards() && count < batch.size(); ++from) {
+            ShardMailboxes::Ring& ring = m_Mailboxes.ring(from, m_Shard);
+            const size_t available = ring.available();
+            const size_t taken = available < batch.size() - count ? available : batch.size() - count;
+            for (size_t i = 0; i < taken; ++i) {
+                batch.data()[count++] = ring.at(i).datagram();
+            }
+            m_Lent[from] = taken;
+        }
+        return count;
+    }
+
+    bool watch(int fd) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        return epoll_ctl(m_Epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+public:
+    ShardTransport(size_t shard, I_HostTransport& socket, ShardMailboxes& mailboxes)
+        : m_Shard(shard)
+        , m_Socket(socket)
+        , m_Mailboxes(mailboxes)
+        , m_Lent(mailboxes.shards())
+        , m_Mailed(mailboxes.shards())
+        , m_Epoll(epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (m_Epoll >= 0 && (!watch(socket.readableFd()) || !watch(mailboxes.wakeFd(shard)))) {
+            close(m_Epoll);
+            m_Epoll = -1;
+        }
+    }
+
+    ShardTransport(const ShardTransport&) = delete;
+    ShardTransport& operator=(const ShardTransport&) = delete;
+
+    virtual ~ShardTransport() {
+        if (m_Epoll >= 0) {
+            close(m_Epoll);
+        }
+    }
+
+    bool ok() const { return m_Epoll >= 0; }
+
+    virtual size_t receive(Span<Datagram> batch) override {
+        for (size_t from = 0; from < m_Lent.size(); ++from) {
+            if (m_Lent[from]) {
+                m_Mailboxes.ring(from, m_Shard).release(m_Lent[from]);
+                m_Lent[from] = 0;
+            }
+        }
+        size_t count = readMailboxes(batch, 0);
+
+        // The socket's payloads are only valid until its next receive(), so it is
+        // read again only if everything it returned was forwarded
+        while (count < batch.size()) {
+            const size_t wanted = batch.size() - count < BatchSize ? batch.size() - count : BatchSize;
+            const size_t received = m_Socket.receive(Span<Datagram>(m_Received, wanted));
+            if (!received) {
+                break;
+            }
+            const Timestamp now = monotonicMillis();
+            const size_t kept = count;
+            for (size_t i = 0; i < received; ++i) {
+                const size_t shard = route(m_Received[i]);
+                if (shard == m_Shard) {
+                    batch.data()[count++] = m_Received[i];
+                } else if (shard == MIXED) {
+                    split(now, m_Received[i]);
+                } else {
+                    forward(shard, now, m_Received[i]);
+                }
+            }
+            if (count != kept) {
+                break;
+            }
+        }
+
+        for (size_t shard = 0; shard < m_Mailed.size(); ++shard) {
+            if (m_Mailed[shard]) {
+                m_Mailed[shard] = false;
+                ++m_Syscalls;
+                m_Mailboxes.wake(shard);
+            }
+        }
+
+        // Before going idle the wakeup is reset, then the mailboxes are read once
+        // more for mail that arrived in between
+        if (!count) {
+            ++m_Syscalls;
+            m_Mailboxes.clear(m_Shard);
+            count = readMailboxes(batch, 0);
+        }
+        return count;
+    }
+
+    // Readable when the socket or the mailboxes are
+    virtual int readableFd() const override { return m_Epoll; }
+    virtual size_t syscalls() const override { return m_Socket.syscalls() + m_Syscalls; }
+    virtual size_t truncated() const override { return m_Socket.truncated(); }
+    virtual int lastError() const override { return m_Socket.lastError(); }
+    // Datagrams passed on to other shards, and those dropped because a mailbox was full
+    size_t forwarded() const { return m_Forwarded; }
+    size_t dropped() const {
+        size_t dropped = 0;
+        for (size_t shard = 0; shard < m_Mailboxes.shards(); ++shard) {
+            dropped += m_Mailboxes.ring(m_Shard, shard).overflows();
+        }
+        return dropped;
+    }
+};
+
+// A shard's stand-in for the LEDs and the display. The colors and the client
+// count are packed into one word, so that the merge sees all three from the same loop.
+class ShardDevice : public I_Device {
+    std::atomic<uint64_t>& m_State;
+    const int m_MergeFd;
+    FILE* m_Log;
+    Color m_Microphone = Color::Initializing;
+    Color m_Webcam = Color::Initializing;
+    uint64_t m_Published;
+
+public:
+    static uint64_t pack(Color microphone, Color webcam, int clients) {
+        return static_cast<uint64_t>(microphone) << 40 | static_cast<uint64_t>(webcam) << 32 | static_cast<uint32_t>(clients);
+    }
+    static Color microphoneOf(uint64_t state) { return static_cast<Color>(state >> 40); }
+    static Color webcamOf(uint64_t state) { return static_cast<Color>((state >> 32) & 0xff); }
+    static int clientsOf(uint64_t state) { return static_cast<int>(state & 0xffffffff); }
+
+    // `mergeFd` is an eventfd written on every change, `log` may be null
+    ShardDevice(std::atomic<uint64_t>& state, int mergeFd, FILE* log)
+        : m_State(state)
+        , m_MergeFd(mergeFd)
+        , m_Log(log)
+        , m_Published(state.load(std::memory_order_relaxed))
+    {}
+
+    virtual void log(StringView message) override {
+        if (m_Log) {
+            std::fwrite(message.data(), 1, message.size(), m_Log);
+        }
+    }
+
+    virtual bool logEnabled() const override { return m_Log != nullptr; }
+    virtual void setMicrophoneLeds(Color color) override { m_Microphone = color; }
+    virtual void setWebcamLeds(Color color) override { m_Webcam = color; }
+
+    // Called once per loop
+    virtual void displayNumber(int number) override {
+        const uint64_t state = pack(m_Microphone, m_Webcam, number);
+        if (state != m_Published) {
+            m_Published = state;
+            m_State.store(state, std::memory_order_release);
+            const uint64_t one = 1;
+            ssize_t written = write(m_MergeFd, &one, sizeof(one));
+            (void)written;
+        }
+    }
+};
+
+// Totals of all shards, valid once they stopped
+struct ShardedStats {
+    size_t datagrams = 0;
+    size_t syscalls = 0;
+    size_t truncated = 0;
+    size_t forwarded = 0;
+    size_t dropped = 0;
+    size_t unchangedPackets = 0;
+    size_t supersededPackets = 0;
+    size_t rejectedPackets = 0;
+};
+
+// Runs a Firmware per thread, each with its own socket on the same port
+// (SO_REUSEPORT) and its own share of the senders, picked by the hash of their
+// key. The threads only share the mailboxes' rings and their published state,
+// which merge() combines into one I_Device from the main thread.
+template<size_t MaxBatch>
+class ShardedHost {
+public:
+    // Makes the receive backend of a shard's socket
+    using TransportFactory = std::function<std::unique_ptr<I_HostTransport>(int socket)>;
+
+private:
+    struct Shard {
+        int socket = -1;
+        std::unique_ptr<I_HostTransport> transport;
+        std::unique_ptr<ShardTransport<MaxBatch>> sharded;
+        std::atomic<uint64_t> state{ShardDevice::pack(Color::Initializing, Color::Initializing, 0)};
+        std::unique_ptr<ShardDevice> device;
+        std::unique_ptr<Firmware> firmware;
+        std::thread thread;
+        size_t datagrams = 0;
+    };
+
+    const size_t m_Budget;
+    ShardMailboxes m_Mailboxes;
+    std::vector<std::unique_ptr<Shard>> m_Shards;
+    int m_MergeFd;
+    int m_StopFd;
+    int m_Error = 0;
+    std::atomic<bool> m_Failed{false};
+    bool m_Started = false;
+    Color m_Microphone = Color::Initializing;
+    Color m_Webcam = Color::Initializing;
+
+    bool setUp(uint32_t ip, uint16_t port, unsigned long clientTimeout_ms, FILE* log, const TransportFactory& makeTransport) {
+        if (m_MergeFd < 0 || m_StopFd < 0 || !m_Mailboxes.ok()) {
+            return false;
+        }
+        for (size_t i = 0; i < m_Mailboxes.shards(); ++i) {
+            std::unique_ptr<Shard> shard = make_unique<Shard>();
+            // Port 0 picks a free port for the first socket, the others join it
+            shard->socket = openUdpSocket(ip, i ? boundPort(m_Shards[0]->socket) : port, true);
+            if (shard->socket < 0) {
+                return false;
+            }
+            shard->transport = makeTransport(shard->socket);
+            if (!shard->transport) {
+                close(shard->socket);
+                return false;
+            }
+            shard->sharded = make_unique<ShardTransport<MaxBatch>>(i, *shard->transport, m_Mailboxes);
+            shard->device = make_unique<ShardDevice>(shard->state, m_MergeFd, log);
+            shard->firmware = make_unique<Firmware>(*shard->device, clientTimeout_ms);
+            const bool ok = shard->sharded->ok();
+            m_Shards.push_back(std::move(shard));
+            if (!ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void run(Shard& shard) {
+        HostLoop<MaxBatch> loop(*shard.firmware, *shard.sharded, m_StopFd, m_Budget);
+        if (loop.ok()) {
+            loop.runIdle();
+            while (loop.runOnce()) {
+            }
+        }
+        shard.datagrams = loop.datagrams();
+        if (!loop.stopped()) {
+            m_Failed = true;
+            const uint64_t one = 1;
+            ssize_t written = write(m_MergeFd, &one, sizeof(one));
+            (void)written;
+        }
+    }
+
+public:
+    // Opens a socket per shard on `ip`:`port`, see ok()
+    ShardedHost(size_t shards, uint32_t ip, uint16_t port, unsigned long clientTimeout_ms, FILE* log, size_t budget,
+            const TransportFactory& makeTransport)
+        : m_Budget(budget)
+        , m_Mailboxes(shards)
+        , m_MergeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        , m_StopFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+        errno = 0;
+        if (!setUp(ip, port, clientTimeout_ms, log, makeTransport)) {
+            m_Error = errno ? errno : EINVAL;
+        }
+    }
+
+    ShardedHost(const ShardedHost&) = delete;
+    ShardedHost& operator=(const ShardedHost&) = delete;
+
+    ~ShardedHost() {
+        stop();
+        for (const std::unique_ptr<Shard>& shard : m_Shards) {
+            shard->sharded.reset();
+            shard->transport.reset();
+            close(shard->socket);
+        }
+        if (m_MergeFd >= 0) {
+            close(m_MergeFd);
+        }
+        if (m_StopFd >= 0) {
+            close(m_StopFd);
+        }
+    }
+
+    bool ok() const { return !m_Error; }
+    int error() const { return m_Error; }
+    size_t shards() const { return m_Shards.size(); }
+    uint16_t port() const { return m_Shards.empty() ? 0 : boundPort(m_Shards[0]->socket); }
+
+    // Readable when a shard's state changed and merge() should be called
+    int mergeFd() const { return m_MergeFd; }
+    // Whether a shard stopped on its own, after an error
+    bool failed() const { return m_Failed; }
+
+    void start() {
+        if (m_Error || m_Started) {
+            return;
+        }
+        m_Started = true;
+        for (const std::unique_ptr<Shard>& shard : m_Shards) {
+            Shard* const running = shard.get();
+            shard->thread = std::thread([this, running] { run(*running); });
+        }
+    }
+
+    void stop() {
+        if (!m_Started) {
+            return;
+        }
+        const uint64_t one = 1;
+        ssize_t written = write(m_StopFd, &one, sizeof(one));
+        (void)written;
+        for (const std::unique_ptr<Shard>& shard : m_Shards) {
+            shard->thread.join();
+        }
+        m_Started = false;
+    }
+
+    // Shows the combined state of all shards on `device`: a color is on if it is
+    // on in any shard, the client count is the sum.
+    void merge(I_Device& device) {
+        uint64_t wakes;
+        ssize_t read_ = read(m_MergeFd, &wakes, sizeof(wakes));
+        (void)read_;
+        int clients = 0;
+        bool microphone = false;
+        bool webcam = false;
+        bool initializing = false;
+        for (const std::unique_ptr<Shard>& shard : m_Shards) {
+            const uint64_t state = shard->state.load(std::memory_order_acquire);
+            clients += ShardDevice::clientsOf(state);
+            microphone = microphone || ShardDevice::microphoneOf(state) == Color::On;
+            webcam = webcam || ShardDevice::webcamOf(state) == Color::On;
+            initializing = initializing || ShardDevice::microphoneOf(state) == Color::Initializing;
+        }
+        // Like the single Firmware, the first state shown is the one after its first loop
+        if (initializing && !clients) {
+            return;
+        }
+        const Color idle = clients ? Color::Off : Color::Standby;
+        const Color microphoneColor = microphone ? Color::On : idle;
+        const Color webcamColor = webcam ? Color::On : idle;
+        if (microphoneColor != m_Microphone || webcamColor != m_Webcam) {
+            m_Microphone = microphoneColor;
+            m_Webcam = webcamColor;
+            device.beginLedFrame();
+            device.setMicrophoneLeds(microphoneColor);
+            device.setWebcamLeds(webcamColor);
+            device.commitLedFrame();
+        }
+        device.displayNumber(clients);
+    }
+
+    ShardedStats stats() const {
+        ShardedStats stats;
+        for (const std::unique_ptr<Shard>& shard : m_Shards) {
+            stats.datagrams += shard->datagrams;
+            stats.syscalls += shard->sharded->syscalls();
+            stats.truncated += shard->sharded->truncated();
+            stats.forwarded += shard->sharded->forwarded();
+            stats.dropped += shard->sharded->dropped();
+            stats.unchangedPackets += shard->firmware->stats().unchangedPackets;
+            stats.supersededPackets += shard->firmware->stats().supersededPackets;
+            stats.rejectedPackets += shard->firmware->stats().rejectedPackets;
+        }
+        return stats;
+    }
+};
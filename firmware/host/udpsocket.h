@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Non-blocking UDP socket bound to `ip`:`port` (host byte order).
+// Returns -1 with errno set on failure.
+inline int openUdpSocket(uint32_t ip, uint16_t port, bool reusePort = false) {
+    const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    const int one = 1;
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        const int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(ip);
+    address.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+        const int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+// Port the socket is bound to, useful after binding to port 0
+inline uint16_t boundPort(int fd) {
+    sockaddr_in address = {};
+    socklen_t size = sizeof(address);
+    if (getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size) < 0) {
+        return 0;
+    }
+    return ntohs(address.sin_port);
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "hosttransport.h"
+
+// Receives from a UDP socket with io_uring: one multishot recvmsg request stays
+// armed and the kernel picks a buffer from a ring of `Buffers` provided buffers for
+// every datagram. receive() only reads the completion queue, so a busy socket costs
+// no syscalls, and the payloads point into the buffers without a copy. They are
+// given back to the kernel on the next receive().
+//
+// Uses the system calls directly, so liburing isn't needed. Needs Linux 6.0 or
+// newer for multishot recvmsg; check ok().
+template<size_t Buffers>
+class UringTransport : public I_HostTransport {
+    static_assert(Buffers && !(Buffers & (Buffers - 1)) && Buffers <= 32768, "Buffers must be a power of two up to 32768");
+
+    // Each buffer holds the recvmsg header, the source address and the payload,
+    // with one byte more than accepted, to detect oversized datagrams
+    static constexpr size_t NAME_SIZE = sizeof(sockaddr_in);
+    static constexpr size_t BUFFER_SIZE = sizeof(io_uring_recvmsg_out) + NAME_SIZE + MAX_PACKET + 1;
+    static constexpr size_t RING_SIZE = Buffers * sizeof(io_uring_buf);
+    static constexpr uint16_t BUFFER_GROUP = 0;
+    // user_data of the requests, to tell their completions apart
+    static constexpr uint64_t RECV_REQUEST = 1;
+    static constexpr uint64_t CANCEL_REQUEST = 2;
+
+    struct Mapping {
+        void* address = MAP_FAILED;
+        size_t size = 0;
+
+        bool map(size_t length, int ringFd, off_t offset) {
+            size = length;
+            address = ringFd < 0
+                ? mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                : mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+            return address != MAP_FAILED;
+        }
+
+        char* at(size_t offset) const { return static_cast<char*>(address) + offset; }
+
+        ~Mapping() {
+            if (address != MAP_FAILED) {
+                munmap(address, size);
+            }
+        }
+    };
+
+    const int m_Socket;
+    int m_Ring = -1;
+    io_uring_params m_Params;
+    Mapping m_SubmissionRing;
+    Mapping m_CompletionRing;
+    Mapping m_Entries;
+    // The provided buffer ring, followed by the buffers themselves
+    Mapping m_Buffers;
+    io_uring_buf_ring* m_BufferRing = nullptr;
+    uint16_t m_BufferTail = 0;
+    msghdr m_Message;
+    bool m_Armed = false;
+    // Buffers whose payloads the last receive() returned
+    uint16_t m_Lent[Buffers];
+    size_t m_LentCount = 0;
+    int m_Error = 0;
+    size_t m_Syscalls = 0;
+    size_t m_Truncated = 0;
+    size_t m_Exhausted = 0;
+    int m_LastError = 0;
+
+    uint32_t* submissionField(uint32_t offset) const { return reinterpret_cast<uint32_t*>(m_SubmissionRing.at(offset)); }
+    uint32_t* completionField(uint32_t offset) const { return reinterpret_cast<uint32_t*>(m_CompletionRing.at(offset)); }
+    char* buffer(uint16_t id) const { return m_Buffers.at(RING_SIZE + id * BUFFER_SIZE); }
+
+    int enter(unsigned submit, unsigned minComplete, unsigned flags) {
+        ++m_Syscalls;
+        return static_cast<int>(syscall(__NR_io_uring_enter, m_Ring, submit, minComplete, flags, nullptr, 0));
+    }
+
+    // Lets `fill` set up the next submission queue entry and submits it
+    template<class Fill>
+    bool submit(Fill fill) {
+        const uint32_t tail = *submissionField(m_Params.sq_off.tail);
+        const uint32_t index = tail & *submissionField(m_Params.sq_off.ring_mask);
+        io_uring_sqe& entry = reinterpret_cast<io_uring_sqe*>(m_Entries.address)[index];
+        std::memset(&entry, 0, sizeof(entry));
+        fill(entry);
+        submissionField(m_Params.sq_off.array)[index] = index;
+        __atomic_store_n(submissionField(m_Params.sq_off.tail), tail + 1, __ATOMIC_RELEASE);
+        return enter(1, 0, 0) == 1;
+    }
+
+    void provide(uint16_t id) {
+        // Not m_BufferRing->bufs: compiled as C++, the header's flexible array
+        // member of the union ends up behind an empty struct, at offset 8
+        io_uring_buf& entry = reinterpret_cast<io_uring_buf*>(m_BufferRing)[m_BufferTail & (Buffers - 1)];
+        entry.addr = reinterpret_cast<uintptr_t>(buffer(id));
+        entry.len = BUFFER_SIZE;
+        entry.bid = id;
+        ++m_BufferTail;
+    }
+
+    void publishBuffers() {
+        __atomic_store_n(&m_BufferRing->tail, m_BufferTail, __ATOMIC_RELEASE);
+    }
+
+    bool setUp() {
+        std::memset(&m_Params, 0, sizeof(m_Params));
+        // Room for a completion per buffer, and then some
+        m_Params.flags = IORING_SETUP_CQSIZE;
+        m_Params.cq_entries = 2 * Buffers;
+        m_Ring = static_cast<int>(syscall(__NR_io_uring_setup, 4, &m_Params));
+        if (m_Ring < 0) {
+            return false;
+        }
+        if (!m_SubmissionRing.map(m_Params.sq_off.array + m_Params.sq_entries * sizeof(uint32_t), m_Ring, IORING_OFF_SQ_RING)
+                || !m_CompletionRing.map(m_Params.cq_off.cqes + m_Params.cq_entries * sizeof(io_uring_cqe), m_Ring, IORING_OFF_CQ_RING)
+                || !m_Entries.map(m_Params.sq_entries * sizeof(io_uring_sqe), m_Ring, IORING_OFF_SQES)
+                || !m_Buffers.map(RING_SIZE + Buffers * BUFFER_SIZE, -1, 0)) {
+            return false;
+        }
+
+        m_BufferRing = static_cast<io_uring_buf_ring*>(m_Buffers.address);
+        io_uring_buf_reg registration;
+        std::memset(&registration, 0, sizeof(registration));
+        registration.ring_addr = reinterpret_cast<uintptr_t>(m_BufferRing);
+        registration.ring_entries = Buffers;
+        registration.bgid = BUFFER_GROUP;
+        ++m_Syscalls;
+        if (syscall(__NR_io_uring_register, m_Ring, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+            return false;
+        }
+        for (size_t id = 0; id < Buffers; ++id) {
+            provide(static_cast<uint16_t>(id));
+        }
+        publishBuffers();
+
+        // The kernel fills in the header, the name and the payload of each buffer
+        std::memset(&m_Message, 0, sizeof(m_Message));
+        m_Message.msg_namelen = NAME_SIZE;
+        return true;
+    }
+
+    // Submits the multishot recvmsg. It ends when the kernel runs out of buffers.
+    void arm() {
+        const bool submitted = submit([this](io_uring_sqe& entry) {
+            entry.opcode = IORING_OP_RECVMSG;
+            entry.fd = m_Socket;
+            entry.addr = reinterpret_cast<uintptr_t>(&m_Message);
+            entry.ioprio = IORING_RECV_MULTISHOT;
+            entry.flags = IOSQE_BUFFER_SELECT;
+            entry.buf_group = BUFFER_GROUP;
+            entry.user_data = RECV_REQUEST;
+        });
+        if (submitted) {
+            m_Armed = true;
+        } else {
+            m_LastError = errno;
+        }
+    }
+
+    // Cancels the recvmsg and waits for its last completion, after which the
+    // kernel no longer writes to the buffers. Closing the ring alone would
+    // cancel it asynchronously, possibly after the buffers are unmapped.
+    void disarm() {
+        const bool submitted = submit([](io_uring_sqe& entry) {
+            entry.opcode = IORING_OP_ASYNC_CANCEL;
+            entry.fd = -1;
+            entry.addr = RECV_REQUEST;
+            entry.user_data = CANCEL_REQUEST;
+        });
+        if (!submitted) {
+            return;
+        }
+        uint32_t* const headField = completionField(m_Params.cq_off.head);
+        const uint32_t mask = *completionField(m_Params.cq_off.ring_mask);
+        const io_uring_cqe* const completions = reinterpret_cast<const io_uring_cqe*>(m_CompletionRing.at(m_Params.cq_off.cqes));
+        while (m_Armed) {
+            uint32_t head = *headField;
+            const uint32_t tail = __atomic_load_n(completionField(m_Params.cq_off.tail), __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe& completion = completions[head & mask];
+                if (completion.user_data == RECV_REQUEST && !(completion.flags & IORING_CQE_F_MORE)) {
+                    m_Armed = false;
+                }
+            }
+            __atomic_store_n(headField, head, __ATOMIC_RELEASE);
+            if (m_Armed && enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                return;
+            }
+        }
+    }
+
+public:
+    // `socket` stays owned by the caller
+    explicit UringTransport(int socket) : m_Socket(socket) {
+        if (!setUp()) {
+            m_Error = errno;
+            return;
+        }
+        arm();
+    }
+
+    UringTransport(const UringTransport&) = delete;
+    UringTransport& operator=(const UringTransport&) = delete;
+
+    virtual ~UringTransport() {
+        if (m_Armed) {
+            disarm();
+        }
+        if (m_Ring >= 0) {
+            close(m_Ring);
+        }
+    }
+
+    bool ok() const { return !m_Error; }
+    // errno of the failed setup, e.g. ENOSYS or EPERM where io_uring isn't available
+    int error() const { return m_Error; }
+
+    virtual size_t receive(Span<Datagram> batch) override {
+        if (m_Error) {
+            return 0;
+        }
+        for (size_t i = 0; i < m_LentCount; ++i) {
+            provide(m_Lent[i]);
+        }
+        m_LentCount = 0;
+        publishBuffers();
+        if (!m_Armed) {
+            arm();
+        }
+
+        uint32_t* const headField = completionField(m_Params.cq_off.head);
+        const uint32_t mask = *completionField(m_Params.cq_off.ring_mask);
+        const io_uring_cqe* const completions = reinterpret_cast<const io_uring_cqe*>(m_CompletionRing.at(m_Params.cq_off.cqes));
+        uint32_t head = *headField;
+        const uint32_t tail = __atomic_load_n(completionField(m_Params.cq_off.tail), __ATOMIC_ACQUIRE);
+        size_t count = 0;
+        for (; head != tail && count < batch.size() && m_LentCount < Buffers; ++head) {
+            const io_uring_cqe& completion = completions[head & mask];
+            if (!(completion.flags & IORING_CQE_F_MORE)) {
+                m_Armed = false;
+            }
+            if (completion.res < 0) {
+                // Out of buffers: the datagrams wait in the socket until rearmed
+                if (completion.res == -ENOBUFS) {
+                    ++m_Exhausted;
+                } else {
+                    m_LastError = -completion.res;
+                }
+                continue;
+            }
+            if (!(completion.flags & IORING_CQE_F_BUFFER)) {
+                continue;
+            }
+            const uint16_t id = static_cast<uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+            m_Lent[m_LentCount++] = id;
+            const char* data = buffer(id);
+            const io_uring_recvmsg_out* header = reinterpret_cast<const io_uring_recvmsg_out*>(data);
+            if (header->payloadlen > MAX_PACKET || (header->flags & MSG_TRUNC)) {
+                ++m_Truncated;
+                continue;
+            }
+            sockaddr_in source;
+            std::memcpy(&source, data + sizeof(io_uring_recvmsg_out), sizeof(source));
+            Datagram& datagram = batch.data()[count++];
+            datagram.payload = StringView(data + sizeof(io_uring_recvmsg_out) + NAME_SIZE, header->payloadlen);
+            datagram.source = Endpoint(ntohl(source.sin_addr.s_addr), ntohs(source.sin_port));
+        }
+        __atomic_store_n(headField, head, __ATOMIC_RELEASE);
+
+        // Without a request the ring's descriptor would never become readable again.
+        // If all buffers are lent, this completes with ENOBUFS after the next receive().
+        if (!m_Armed) {
+            arm();
+        }
+        return count;
+    }
+
+    virtual int readableFd() const override { return m_Ring; }
+    virtual size_t syscalls() const override { return m_Syscalls; }
+    virtual size_t truncated() const override { return m_Truncated; }
+    virtual int lastError() const override { return m_LastError; }
+    // Times the kernel ran out of buffers, which happens with large backlogs
+    size_t exhausted() const { return m_Exhausted; }
+};
@@ -1,17 +1,30 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <iterator>
-#include <unordered_map>
 
+#include "clienttable.h"
+#include "logging.h"
+#include "statusparser.h"
 #include "stdextra.h"
 
-#define ARDUINOJSON_ENABLE_STD_STRING 1
-#include "ArduinoJson-v6.18.0.h"
-
 constexpr unsigned long DEFAULT_CLIENT_TIMEOUT_MS = 30000;
 
-using Timestamp = unsigned long;
+// Number of clients tracked at once, the table is allocated as part of Firmware.
+// Every client takes about 185 bytes (its slot and three lookup tables), and the
+// ESP8266 has about 45 KB of heap left with WiFi up: 128 clients use half of it,
+// the rest is for lwIP's receive buffers and the log ring. Packets of further
+// senders are ignored, and counted, until a tracked client times out.
+#ifndef CHECKMEET_MAX_CLIENTS
+#define CHECKMEET_MAX_CLIENTS 128
+#endif
+
+// Milliseconds as returned by millis() on the device. It wraps around after ~49 days,
+// so timestamps must only be compared through their difference.
+using Timestamp = uint32_t;
 
 enum class Color {
     On, Off, Standby, Initializing
@@ -20,88 +33,408 @@ enum class Color {
 class I_Device {
 public:
     virtual void log(StringView message) = 0;
+    // Devices nobody is listening to can return false so that log messages are not even formatted
+    virtual bool logEnabled() const { return true; }
+    // LED changes are made between beginLedFrame() and commitLedFrame(). Devices
+    // may stage them and refresh the strip only once, on commit.
+    virtual void beginLedFrame() {}
     virtual void setMicrophoneLeds(Color color) = 0;
     virtual void setWebcamLeds(Color color) = 0;
+    virtual void commitLedFrame() {}
     virtual void displayNumber(int number) = 0;
     virtual ~I_Device() = default;
 };
 
+struct Datagram {
+    StringView payload;
+    Endpoint source;
+};
+
+// Source of received datagrams, e.g. a UDP socket
+class I_Transport {
+public:
+    // Fills the front of `batch` with datagrams that are ready without waiting and
+    // returns their number. The payloads stay valid until the next call.
+    virtual size_t receive(Span<Datagram> batch) = 0;
+    virtual ~I_Transport() = default;
+};
+
 class I_Firmware {
 public:
-    virtual void udpReceived(Timestamp ts, StringView incomingPacket) = 0;
+    virtual void udpReceived(Timestamp ts, const Endpoint& source, StringView incomingPacket) = 0;
+    // For packets whose source is not known
+    void udpReceived(Timestamp ts, StringView incomingPacket) { udpReceived(ts, Endpoint(), incomingPacket); }
+    // Same as calling udpReceived() for each datagram, but the LEDs are refreshed only once
+    virtual void udpReceivedBatch(Timestamp ts, Span<const Datagram> batch) = 0;
     virtual void loopStarted(Timestamp ts) = 0;
     virtual void loopEnded(Timestamp ts) = 0;
+    // Earliest timestamp at which loopStarted() has work to do without new packets.
+    // Returns false if there is no such deadline, i.e. no client is tracked.
+    virtual bool nextDeadline(Timestamp& deadline) const = 0;
     virtual ~I_Firmware() = default;
 };
 
+// Counters for things the firmware absorbs silently
+struct FirmwareStats {
+    // Packets dropped from a batch because a newer one from the same sender followed
+    size_t supersededPackets = 0;
+    // Byte-identical repeats of a sender's last packet, handled without parsing
+    size_t unchangedPackets = 0;
+    // Packets of new senders ignored because CHECKMEET_MAX_CLIENTS were tracked
+    size_t rejectedPackets = 0;
+};
+
+// A tracked client, as reported by Firmware::forEachClient()
+struct ClientStatus {
+    SenderKey key;
+    Endpoint source; // unknown for clients only heard of through a relay
+    Timestamp lastUpdate = 0;
+    bool microphone = false;
+    bool webcam = false;
+};
+
 class Firmware : public I_Firmware {
     I_Device& m_Device;
+    FirmwareStats m_Stats;
 
     struct ClientInfo {
         Timestamp lastUpdate = 0;
+        PayloadFingerprint lastPayload;
+        Endpoint source;
         bool microphone = false;
         bool webcam = false;
     };
 
-    using Clients = std::unordered_map<std::string, ClientInfo>;
+    using Clients = ClientTable<ClientInfo, CHECKMEET_MAX_CLIENTS>;
     Clients m_Clients;
+    // Last payload of every client, heartbeats repeat it byte for byte
+    FlatMap<PayloadFingerprint, Clients::SlotId, 2 * CHECKMEET_MAX_CLIENTS> m_LastPayloads;
+    // Where each client last sent from, so a known sender is found with one integer lookup
+    FlatMap<Endpoint, Clients::SlotId, 2 * CHECKMEET_MAX_CLIENTS> m_Endpoints;
     const unsigned long m_ClientTimeout_ms;
 
+    // Number of clients with microphone / webcam on, kept up to date on every
+    // change so that the LED state doesn't need a scan over all clients
+    size_t m_MicrophoneCount = 0;
+    size_t m_WebcamCount = 0;
+
+    void updateClient(ClientInfo& client, bool microphone, bool webcam) {
+        m_MicrophoneCount += static_cast<size_t>(microphone) - static_cast<size_t>(client.microphone);
+        m_WebcamCount += static_cast<size_t>(webcam) - static_cast<size_t>(client.webcam);
+        client.microphone = microphone;
+        client.webcam = webcam;
+    }
+
+    void forgetClient(Clients::SlotId slot) {
+        const ClientInfo& client = m_Clients[slot];
+        m_MicrophoneCount -= client.microphone;
+        m_WebcamCount -= client.webcam;
+        forgetPayload(slot);
+        forgetEndpoint(slot);
+    }
+
+    void forgetEndpoint(Clients::SlotId slot) {
+        const Endpoint& source = m_Clients[slot].source;
+        const Clients::SlotId* owner = m_Endpoints.find(source);
+        if (owner && *owner == slot) {
+            m_Endpoints.erase(source);
+        }
+    }
+
+    void rememberEndpoint(Clients::SlotId slot, const Endpoint& source) {
+        if (!source.known() || m_Clients[slot].source == source) {
+            return;
+        }
+        forgetEndpoint(slot);
+        m_Clients[slot].source = source;
+        m_Endpoints.insert(source, slot);
+    }
+
+    void forgetPayload(Clients::SlotId slot) {
+        const PayloadFingerprint& fingerprint = m_Clients[slot].lastPayload;
+        const Clients::SlotId* owner = m_LastPayloads.find(fingerprint);
+        if (owner && *owner == slot) {
+            m_LastPayloads.erase(fingerprint);
+        }
+    }
+
+    void rememberPayload(Clients::SlotId slot, const PayloadFingerprint& fingerprint) {
+        if (m_Clients[slot].lastPayload == fingerprint) {
+            return;
+        }
+        forgetPayload(slot);
+        m_Clients[slot].lastPayload = fingerprint;
+        m_LastPayloads.insert(fingerprint, slot);
+    }
+
+    // Slot of the client at `source` whose last packet was exactly these bytes,
+    // NO_SLOT if none. Senders without a senderId may send identical bytes, so a
+    // packet can only repeat one from the same endpoint.
+    Clients::SlotId findRepeatedPayload(const Endpoint& source, const PayloadFingerprint& fingerprint) const {
+        if (source.known()) {
+            const Clients::SlotId* slot = m_Endpoints.find(source);
+            return slot && m_Clients[*slot].lastPayload == fingerprint ? *slot : Clients::NO_SLOT;
+        }
+        const Clients::SlotId* slot = m_LastPayloads.find(fingerprint);
+        const bool repeated = slot && m_Clients[*slot].lastPayload == fingerprint && !m_Clients[*slot].source.known();
+        return repeated ? *slot : Clients::NO_SLOT;
+    }
+
+    // A repeated packet can only keep its sender alive
+    void refreshClient(Timestamp ts, Clients::SlotId slot) {
+        m_Clients.touch(slot);
+        m_Clients[slot].lastUpdate = ts;
+        ++m_Stats.unchangedPackets;
+    }
+
+    void verifyAggregates() const {
+#ifndef NDEBUG
+        size_t microphone = 0;
+        size_t webcam = 0;
+        m_Clients.forEach([&](const ClientInfo& client) {
+            microphone += client.microphone;
+            webcam += client.webcam;
+        });
+        assert(microphone == m_MicrophoneCount);
+        assert(webcam == m_WebcamCount);
+#endif
+    }
+
+    bool isExpired(const ClientInfo& client, Timestamp ts) const {
+        return static_cast<Timestamp>(ts - client.lastUpdate) > m_ClientTimeout_ms;
+    }
+
+    // Last committed LED colors, so that every change is one frame and no change is none
+    Color m_MicrophoneLeds = Color::Initializing;
+    Color m_WebcamLeds = Color::Initializing;
+
+    void showLeds(Color microphone, Color webcam) {
+        if (microphone == m_MicrophoneLeds && webcam == m_WebcamLeds) {
+            return;
+        }
+        m_Device.beginLedFrame();
+        if (microphone != m_MicrophoneLeds) {
+            m_Device.setMicrophoneLeds(microphone);
+            m_MicrophoneLeds = microphone;
+        }
+        if (webcam != m_WebcamLeds) {
+            m_Device.setWebcamLeds(webcam);
+            m_WebcamLeds = webcam;
+        }
+        m_Device.commitLedFrame();
+    }
+
     void refreshLeds() {
+        verifyAggregates();
         if (m_Clients.empty()) {
-            m_Device.setMicrophoneLeds(Color::Standby);
-            m_Device.setWebcamLeds(Color::Standby);
+            showLeds(Color::Standby, Color::Standby);
             return;
         }
-        bool microphone = std::any_of(m_Clients.begin(), m_Clients.end(), [](const Clients::value_type& p) { return p.second.microphone; });
-        bool webcam = std::any_of(m_Clients.begin(), m_Clients.end(), [](const Clients::value_type& p) { return p.second.webcam; });
-        m_Device.setMicrophoneLeds(microphone ? Color::On : Color::Off);
-        m_Device.setWebcamLeds(webcam ? Color::On : Color::Off);
+        showLeds(m_MicrophoneCount ? Color::On : Color::Off, m_WebcamCount ? Color::On : Color::Off);
     }
+
+    // What a packet says about its sender, everything needed to apply it
+    struct Status {
+        SenderKey key;
+        PayloadFingerprint payload;
+        Endpoint source;
+        Clients::SlotId repeatOf = Clients::NO_SLOT; // set for unchanged packets, which aren't parsed
+        bool microphone = false;
+        bool webcam = false;
+    };
+
+    // Datagrams of a batch are coalesced within windows of this many packets
+    static constexpr size_t COALESCE_WINDOW = 16;
+
+    bool parsePacket(const Endpoint& source, StringView incomingPacket, Status& status) {
+        status.source = source;
+        status.payload = PayloadFingerprint::of(incomingPacket);
+        status.repeatOf = findRepeatedPayload(source, status.payload);
+        if (status.repeatOf != Clients::NO_SLOT) {
+            status.key = m_Clients.keyOf(status.repeatOf);
+            return true;
+        }
+
+        if (StatusParser::isText(incomingPacket)) {
+            CHECKMEET_LOG_DEBUG(m_Device, LogToken::UdpPacketContents, incomingPacket);
+        }
+
+        // senderId points into the packet or the parser, no copy is needed to compute the key
+        StatusParser parser;
+        StatusMessage message;
+        if (const char* error = parser.parse(incomingPacket, message)) {
+            CHECKMEET_LOG_ERROR(m_Device, LogToken::ParseFailed, error);
+            return false;
+        }
+
+        CHECKMEET_LOG_DEBUG(m_Device, LogToken::Version, message.version);
+        if (message.hasSenderId()) {
+            CHECKMEET_LOG_DEBUG(m_Device, LogToken::SenderId, LogSenderId{message.senderId});
+        }
+        CHECKMEET_LOG_DEBUG(m_Device, LogToken::Microphone, message.microphone ? "ON" : "OFF");
+        CHECKMEET_LOG_DEBUG(m_Device, LogToken::Webcam, message.webcam ? "ON" : "OFF");
+
+        status.key = senderKey(source, message);
+        status.microphone = message.microphone;
+        status.webcam = message.webcam;
+        return true;
+    }
+
+    void applyStatus(Timestamp ts, const Status& status) {
+        if (status.repeatOf != Clients::NO_SLOT) {
+            refreshClient(ts, status.repeatOf);
+            return;
+        }
+        auto slot = m_Clients.find(status.key);
+        if (slot == Clients::NO_SLOT) {
+            slot = m_Clients.insert(status.key);
+            if (slot == Clients::NO_SLOT) {
+                ++m_Stats.rejectedPackets;
+                CHECKMEET_LOG_ERROR(m_Device, LogToken::TooManyClients);
+                return;
+            }
+            CHECKMEET_LOG_INFO(m_Device, LogToken::NewClient, m_Clients.size());
+        }
+        m_Clients.touch(slot);
+        ClientInfo& client = m_Clients[slot];
+        client.lastUpdate = ts;
+        updateClient(client, status.microphone, status.webcam);
+        rememberPayload(slot, status.payload);
+        rememberEndpoint(slot, status.source);
+    }
+
+    // A relay's batch frame is applied as a whole or, if malformed, not at all.
+    // The entries belong to other senders than the relay, so they aren't tied to its endpoint.
+    void applyBatchFrame(Timestamp ts, StringView frame) {
+        size_t count = 0;
+        if (const char* error = StatusParser::checkBatchFrame(frame, count)) {
+            CHECKMEET_LOG_ERROR(m_Device, LogToken::ParseFailed, error);
+            return;
+        }
+        CHECKMEET_LOG_DEBUG(m_Device, LogToken::BatchFrame, count);
+        for (size_t i = 0; i < count; ++i) {
+            StatusMessage message;
+            StatusParser::decodeBatchEntry(frame, i, message);
+            Status status;
+            status.key = message.senderUuid;
+            status.payload = PayloadFingerprint::of(StatusParser::batchEntry(frame, i));
+            status.microphone = message.microphone;
+            status.webcam = message.webcam;
+            applyStatus(ts, status);
+        }
+    }
+
+    // Only the newest status of each sender in the window is applied, so catching
+    // up on a backlog costs one update per distinct sender rather than per packet
+    void applyCoalesced(Timestamp ts, Span<const Datagram> window) {
+        Status statuses[COALESCE_WINDOW];
+        size_t count = 0;
+        for (const Datagram& datagram : window) {
+            if (parsePacket(datagram.source, datagram.payload, statuses[count])) {
+                ++count;
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            const bool superseded = std::any_of(statuses + i + 1, statuses + count, [&](const Status& later) {
+                return later.key == statuses[i].key;
+            });
+            if (superseded) {
+                ++m_Stats.supersededPackets;
+                continue;
+            }
+            applyStatus(ts, statuses[i]);
+        }
+    }
+
 public:
     explicit Firmware(I_Device &device, unsigned long clientTimeout_ms = DEFAULT_CLIENT_TIMEOUT_MS)
         : m_Device(device)
         , m_ClientTimeout_ms(clientTimeout_ms)
     {
+          m_Device.beginLedFrame();
           m_Device.setMicrophoneLeds(Color::Initializing);
           m_Device.setWebcamLeds(Color::Initializing);
+          m_Device.commitLedFrame();
     }
 
-    virtual void udpReceived(Timestamp ts, StringView incomingPacket) override {
-        m_Device.log(fmt("UDP packet contents: %.*s\n", static_cast<int>(incomingPacket.size()), incomingPacket.data()));
-
-        StaticJsonDocument<256> doc;
-        DeserializationError error = deserializeJson(doc, incomingPacket.data(), incomingPacket.size());
+    using I_Firmware::udpReceived;
 
-        // Test if parsing succeeds.
-        if (error) {
-            m_Device.log("deserializeJson() failed: "_sv);
-            m_Device.log(error.c_str());
+    virtual void udpReceived(Timestamp ts, const Endpoint& source, StringView incomingPacket) override {
+        if (StatusParser::isBatchFrame(incomingPacket)) {
+            applyBatchFrame(ts, incomingPacket);
+            refreshLeds();
             return;
         }
-
-        m_Device.log(fmt("version %d\n", doc["version"].as<int>()));
-        std::string senderId;
-        if (doc.containsKey("senderId")) {
-            senderId = doc["senderId"].as<std::string>();
-            m_Device.log(fmt("senderId %s\n", senderId.c_str()));
+        Status status;
+        if (!parsePacket(source, incomingPacket, status)) {
+            refreshLeds();
+            return;
         }
-        const auto microphone = doc["microphone"].as<bool>();
-        const auto webcam = doc["webcam"].as<bool>();
-        m_Device.log(fmt("microphone %s\n", microphone ? "ON" : "OFF"));
-        m_Device.log(fmt("webcam %s\n", webcam ? "ON" : "OFF"));
+        applyStatus(ts, status);
+        if (status.repeatOf == Clients::NO_SLOT) {
+            refreshLeds();
+        }
+    }
 
-        ClientInfo& client = m_Clients[senderId];
-        client.lastUpdate = ts;
-        client.microphone = microphone;
-        client.webcam = webcam;
+    // All datagrams of a batch share the timestamp, so an older packet from a sender
+    // is fully superseded by a newer one later in the batch
+    virtual void udpReceivedBatch(Timestamp ts, Span<const Datagram> batch) override {
+        const Datagram* const datagrams = batch.data();
+        size_t begin = 0;
+        while (begin < batch.size()) {
+            if (StatusParser::isBatchFrame(datagrams[begin].payload)) {
+                applyBatchFrame(ts, datagrams[begin].payload);
+                ++begin;
+                continue;
+            }
+            // Coalesce up to the next batch frame, to keep the order of updates per sender
+            size_t end = begin + 1;
+            while (end < batch.size() && end - begin < COALESCE_WINDOW && !StatusParser::isBatchFrame(datagrams[end].payload)) {
+                ++end;
+            }
+            applyCoalesced(ts, Span<const Datagram>(datagrams + begin, end - begin));
+            begin = end;
+        }
         refreshLeds();
     }
 
+    const FirmwareStats& stats() const { return m_Stats; }
+
+    // Visits the clients from the least to the most recently updated one
+    template<class Fn>
+    void forEachClient(Fn fn) const {
+        for (auto slot = m_Clients.oldest(); slot != Clients::NO_SLOT; slot = m_Clients.newer(slot)) {
+            const ClientInfo& info = m_Clients[slot];
+            ClientStatus client;
+            client.key = m_Clients.keyOf(slot);
+            client.source = info.source;
+            client.lastUpdate = info.lastUpdate;
+            client.microphone = info.microphone;
+            client.webcam = info.webcam;
+            fn(client);
+        }
+    }
+
+    // The identity a parsed status message is tracked under. Without a senderId
+    // the source is the best identity there is.
+    static SenderKey senderKey(const Endpoint& source, const StatusMessage& message) {
+        if (message.version == StatusFrame::VERSION) {
+            return message.senderUuid;
+        }
+        if (message.hasSenderId() || !source.known()) {
+            return SenderKey::fromSenderId(message.senderId);
+        }
+        return SenderKey::fromEndpoint(source);
+    }
+
+    // Timestamps are expected to be non-decreasing (modulo wrap-around), so clients
+    // in touch order are also in lastUpdate order and only expired ones are visited.
     virtual void loopStarted(Timestamp ts) override {
-        erase_if(m_Clients, [ts, this](const Clients::value_type& p) {
-            return ts - p.second.lastUpdate > m_ClientTimeout_ms;
-        });
+        for (auto slot = m_Clients.oldest(); slot != Clients::NO_SLOT && isExpired(m_Clients[slot], ts); slot = m_Clients.oldest()) {
+            forgetClient(slot);
+            m_Clients.erase(slot);
+            CHECKMEET_LOG_INFO(m_Device, LogToken::ClientTimedOut, m_Clients.size());
+        }
         refreshLeds();
     }
 
@@ -109,6 +442,32 @@ public:
         (void)ts;
         m_Device.displayNumber(m_Clients.size());
     }
+
+    virtual bool nextDeadline(Timestamp& deadline) const override {
+        const auto slot = m_Clients.oldest();
+        if (slot == Clients::NO_SLOT) {
+            return false;
+        }
+        deadline = static_cast<Timestamp>(m_Clients[slot].lastUpdate + m_ClientTimeout_ms + 1);
+        return true;
+    }
 };
 
-int rnd() { return 4; }
+// Hands up to `budget` received datagrams to the firmware, in batches of at most
+// MaxBatch. Returns the number of datagrams processed.
+template<size_t MaxBatch>
+size_t receiveDatagrams(I_Transport& transport, I_Firmware& firmware, Timestamp ts, size_t budget) {
+    Datagram batch[MaxBatch];
+    size_t total = 0;
+    while (total < budget) {
+        const size_t received = transport.receive(Span<Datagram>(batch, std::min(MaxBatch, budget - total)));
+        if (!received) {
+            break;
+        }
+        firmware.udpReceivedBatch(ts, Span<const Datagram>(batch, received));
+        total += received;
+    }
+    return total;
+}
+
+inline int rnd() { return 4; }
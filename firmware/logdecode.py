@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+# Turns the tokenized log output of the firmware (CHECKMEET_LOG_TOKENIZED) back into text.
+# Frames are described in logging.h, the token table is read from logtokens.h.
+#
+#   python3 logdecode.py capture.bin
+#   python3 logdecode.py --port /dev/ttyUSB0     (needs pyserial)
+#   python3 logdecode.py --table                 (prints the token table as JSON)
+import argparse
+import codecs
+import json
+import os
+import re
+import sys
+import unittest
+
+LOG_FRAME_MARKER = 0x1e
+TOKENS_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'logtokens.h')
+
+def read_token_table(path=TOKENS_HEADER):
+    with open(path, 'r') as f:
+        text = f.read()
+    entries = re.findall(r'X\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', text)
+    return [(name, codecs.decode(fmt, 'unicode_escape')) for name, fmt in entries]
+
+class Decoder:
+    def __init__(self, table):
+        self.table = table
+        self.buffer = bytearray()
+
+    @staticmethod
+    def _varint(data, pos):
+        value = 0
+        shift = 0
+        while True:
+            if pos >= len(data):
+                raise IndexError
+            byte = data[pos]
+            pos += 1
+            value |= (byte & 0x7f) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value, pos
+
+    def _args(self, body):
+        args = []
+        pos = 0
+        while pos < len(body):
+            tag = chr(body[pos])
+            pos += 1
+            if tag == 'i':
+                value, pos = self._varint(body, pos)
+                args.append(str((value >> 1) ^ -(value & 1)))
+            elif tag == 'u':
+                value, pos = self._varint(body, pos)
+                args.append(str(value))
+            elif tag in 'TF':
+                args.append('true' if tag == 'T' else 'false')
+            elif tag == 'a':
+                args.append('.'.join(str(octet) for octet in body[pos:pos + 4]))
+                pos += 4
+            elif tag == 'U':
+                text = body[pos:pos + 16].hex()
+                args.append(f'{text[:8]}-{text[8:12]}-{text[12:16]}-{text[16:20]}-{text[20:]}')
+                pos += 16
+            elif tag == 's':
+                size, pos = self._varint(body, pos)
+                args.append(body[pos:pos + size].decode('utf-8', 'replace'))
+                pos += size
+            else:
+                args.append(f'<unknown argument type {tag!r}>')
+                break
+        return args
+
+    def _render(self, token, args):
+        if token >= len(self.table):
+            return f'<unknown token {token}: {args}>\n'
+        parts = self.table[token][1].split('{}')
+        text = parts[0]
+        for i, part in enumerate(parts[1:]):
+            text += (args[i] if i < len(args) else '{}') + part
+        return text
+
+    # Returns the text decoded from `data` and from what was left over of earlier calls
+    def feed(self, data):
+        self.buffer += data
+        out = []
+        while self.buffer:
+            marker = self.buffer.find(LOG_FRAME_MARKER)
+            if marker != 0:
+                plain = self.buffer if marker < 0 else self.buffer[:marker]
+                out.append(plain.decode('utf-8', 'replace'))
+                del self.buffer[:len(plain)]
+                continue
+            try:
+                length, start = self._varint(self.buffer, 1)
+            except IndexError:
+                break
+            if len(self.buffer) < start + length:
+                break
+            body = bytes(self.buffer[start:start + length])
+            del self.buffer[:start + length]
+            if body:
+                out.append(self._render(body[0], self._args(body[1:])))
+        return ''.join(out)
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode tokenized CheckMeet logs')
+    parser.add_argument('input', nargs='?', help='File with captured serial output, stdin if omitted')
+    parser.add_argument('--port', help='Read from this serial port instead')
+    parser.add_argument('--baud', default=74880, type=int, help='Serial port speed')
+    parser.add_argument('--table', action='store_true', help='Print the token table and exit')
+    args = parser.parse_args()
+
+    table = read_token_table()
+    if args.table:
+        print(json.dumps([{'token': i, 'name': name, 'format': fmt} for i, (name, fmt) in enumerate(table)], indent=4))
+        return
+
+    decoder = Decoder(table)
+    if args.port:
+        import serial
+        source = serial.Serial(args.port, args.baud)
+        read = lambda: source.read(max(1, source.in_waiting))
+    else:
+        source = open(args.input, 'rb') if args.input else sys.stdin.buffer
+        read = lambda: source.read1(4096) if hasattr(source, 'read1') else source.read(4096)
+    try:
+        while True:
+            data = read()
+            if not data:
+                break
+            sys.stdout.write(decoder.feed(data))
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+
+class TestDecoder(unittest.TestCase):
+
+    def test_table_matches_logging_tests(self):
+        names = [name for name, _ in read_token_table()]
+        self.assertEqual(names.index('TooManyClients'), 6)
+        self.assertEqual(names.index('ButtonChanged'), 10)
+
+    def test_frames(self):
+        decoder = Decoder(read_token_table())
+        # same frames as in catch/catch_logging.cpp
+        self.assertEqual(decoder.feed(bytes([0x1e, 1, 6])), 'Too many clients, packet ignored\n')
+        self.assertEqual(decoder.feed(bytes([0x1e, 5, 3, ord('s'), 2, ord('a'), ord('b')])), 'senderId ab\n')
+        self.assertEqual(decoder.feed(bytes([0x1e, 8, 9, ord('i'), 3, ord('s'), 0, ord('u'), 0xac, 0x02])), 'Received -2 bytes from , port 300\n')
+
+    def test_addresses_and_uuids(self):
+        decoder = Decoder(read_token_table())
+        # same frames as in catch/catch_logging.cpp
+        self.assertEqual(decoder.feed(bytes([0x1e, 13, 9, ord('i'), 200, 1, ord('a'), 10, 0, 0, 2, ord('u'), 0xf7, 0xd2, 0x01])),
+            'Received 100 bytes from 10.0.0.2, port 26999\n')
+        uuid = bytes.fromhex('51000b59b3eb4664a895e824260d9050')
+        self.assertEqual(decoder.feed(bytes([0x1e, 18, 3, ord('U')]) + uuid), 'senderId 51000b59-b3eb-4664-a895-e824260d9050\n')
+
+    def test_long_string_before_other_arguments(self):
+        decoder = Decoder(read_token_table())
+        # same frame as in catch/catch_logging.cpp
+        uuid = bytes.fromhex('51000b59b3eb4664a895e824260d9050')
+        body = bytes([9, ord('s'), 0xe1, 0x01]) + b'x' * 225 + bytes([ord('U')]) + uuid + bytes([ord('u'), 0xf7, 0xd2, 0x01])
+        self.assertEqual(len(body), 250)
+        self.assertEqual(decoder.feed(bytes([0x1e, 0xfa, 0x01]) + body),
+            'Received ' + 'x' * 225 + ' bytes from 51000b59-b3eb-4664-a895-e824260d9050, port 26999\n')
+
+    def test_split_frames_and_plain_text(self):
+        decoder = Decoder(read_token_table())
+        self.assertEqual(decoder.feed(b'Connected \\o/\n\x1e\x02\x0a'), 'Connected \\o/\n')
+        self.assertEqual(decoder.feed(b'T'), 'button goes true\n')
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1 and sys.argv[1] == 'test':
+        unittest.main(argv=sys.argv[:1])
+    else:
+        main()
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#include "clienttable.h"
+#include "logtokens.h"
+#include "stdextra.h"
+
+// Compile-time log levels. Select one per build by defining CHECKMEET_LOG_LEVEL
+// (before including lib_firmware.h, or with -D). Log statements above the
+// selected level expand to nothing: no formatting, no string, no virtual call.
+#define CHECKMEET_LOG_LEVEL_NONE 0
+#define CHECKMEET_LOG_LEVEL_ERROR 1
+#define CHECKMEET_LOG_LEVEL_INFO 2
+#define CHECKMEET_LOG_LEVEL_DEBUG 3
+
+#ifndef CHECKMEET_LOG_LEVEL
+#define CHECKMEET_LOG_LEVEL CHECKMEET_LOG_LEVEL_DEBUG
+#endif
+
+enum class LogToken : uint8_t {
+#define CHECKMEET_LOG_TOKEN_NAME(name, format) name,
+    CHECKMEET_LOG_TOKENS(CHECKMEET_LOG_TOKEN_NAME)
+#undef CHECKMEET_LOG_TOKEN_NAME
+};
+
+inline const char* logFormat(LogToken token) {
+#define CHECKMEET_LOG_TOKEN_FORMAT(name, format) format,
+    static const char* const formats[] = { CHECKMEET_LOG_TOKENS(CHECKMEET_LOG_TOKEN_FORMAT) };
+#undef CHECKMEET_LOG_TOKEN_FORMAT
+    return formats[static_cast<size_t>(token)];
+}
+
+// IPv4 address argument, in the order it is written
+struct LogIPv4 {
+    uint8_t octets[4];
+};
+
+// senderId argument. UUIDs are sent as their 16 bytes when tokenized, and
+// decoded in lower case.
+struct LogSenderId {
+    StringView text;
+};
+
+// Text rendering of log arguments, `Out` is a string type with append(data, size)
+
+template<class Out>
+void appendLogArg(Out& out, StringView value) { out.append(value.data(), value.size()); }
+template<class Out>
+void appendLogArg(Out& out, const char* value) { appendLogArg(out, value ? StringView(value) : "(null)"_sv); }
+template<class Out>
+void appendLogArg(Out& out, bool value) { appendLogArg(out, value ? "true"_sv : "false"_sv); }
+template<class Out>
+void appendLogArg(Out& out, const LogSenderId& value) { appendLogArg(out, value.text); }
+template<class Out>
+void appendLogArg(Out& out, const LogIPv4& value) {
+    char buffer[16];
+    out.append(buffer, std::snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", value.octets[0], value.octets[1], value.octets[2], value.octets[3]));
+}
+
+template<class Out, class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+appendLogArg(Out& out, T value) {
+    char buffer[24];
+    out.append(buffer, std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value)));
+}
+
+template<class Out, class T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+appendLogArg(Out& out, T value) {
+    char buffer[24];
+    out.append(buffer, std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value)));
+}
+
+template<class Out>
+void renderLog(Out& out, const char* format) {
+    appendLogArg(out, StringView(format));
+}
+
+template<class Out, class Arg, class... Args>
+void renderLog(Out& out, const char* format, const Arg& arg, const Args&... args) {
+    const char* placeholder = std::strstr(format, "{}");
+    if (!placeholder) {
+        appendLogArg(out, StringView(format));
+        return;
+    }
+    out.append(format, placeholder - format);
+    appendLogArg(out, arg);
+    renderLog(out, placeholder + 2, args...);
+}
+
+// Tokenized log messages, see logdecode.py for the decoder. A frame is
+// LOG_FRAME_MARKER, the varint length of the rest, the token, then a type tag
+// and a value for each argument. Integers are (zigzag) varints, strings are
+// a varint length and the bytes, truncated to leave room for the arguments
+// after them. IPv4 addresses are their 4 bytes, UUIDs their 16 bytes. An
+// argument is either encoded whole or, with all arguments after it, left out.
+constexpr uint8_t LOG_FRAME_MARKER = 0x1e;
+
+class LogFrame {
+    static constexpr size_t MAX_BODY = 250;
+    static constexpr size_t HEADER = 3; // marker and a varint of at most 2 bytes
+    uint8_t m_Data[HEADER + MAX_BODY];
+    size_t m_Size = HEADER;
+    size_t m_Reserved = 0; // for the arguments after the current one
+
+    size_t room() const { return sizeof(m_Data) - m_Size; }
+
+    void put(uint8_t byte) {
+        m_Data[m_Size++] = byte;
+    }
+
+    static size_t varintSize(uint64_t value) {
+        size_t size = 1;
+        while (value > 0x7f) {
+            value >>= 7;
+            ++size;
+        }
+        return size;
+    }
+
+    void putVarint(uint64_t value) {
+        do {
+            put(static_cast<uint8_t>((value & 0x7f) | (value > 0x7f ? 0x80 : 0)));
+            value >>= 7;
+        } while (value);
+    }
+
+    // The longest encoding of each argument type, strings count as empty
+    static size_t maxSize(StringView) { return 2; }
+    static size_t maxSize(const char*) { return 2; }
+    static size_t maxSize(bool) { return 1; }
+    static size_t maxSize(const LogIPv4&) { return 5; }
+    static size_t maxSize(const LogSenderId&) { return 17; }
+    template<class T>
+    static typename std::enable_if<std::is_integral<T>::value, size_t>::type maxSize(T) {
+        return 1 + (sizeof(T) * 8 + 6) / 7;
+    }
+
+    static size_t maxSizes() { return 0; }
+    template<class Arg, class... Args>
+    static size_t maxSizes(const Arg& arg, const Args&... args) { return maxSize(arg) + maxSizes(args...); }
+
+    // Each putArg returns false, without writing anything, if the argument doesn't fit
+
+    bool putArg(StringView value) {
+        const size_t lengthSize = 2; // MAX_BODY needs at most 2 varint bytes
+        const size_t used = 1 + lengthSize + m_Reserved;
+        const size_t size = std::min(value.size(), room() > used ? room() - used : 0);
+        if (room() < 1 + varintSize(size) + size) {
+            return false;
+        }
+        put('s');
+        putVarint(size);
+        std::memcpy(m_Data + m_Size, value.data(), size);
+        m_Size += size;
+        return true;
+    }
+    bool putArg(const char* value) { return putArg(value ? StringView(value) : "(null)"_sv); }
+    bool putArg(bool value) {
+        if (room() < 1) {
+            return false;
+        }
+        put(value ? 'T' : 'F');
+        return true;
+    }
+    bool putArg(const LogIPv4& value) {
+        if (room() < 5) {
+            return false;
+        }
+        put('a');
+        for (uint8_t octet : value.octets) {
+            put(octet);
+        }
+        return true;
+    }
+    bool putArg(const LogSenderId& value) {
+        SenderKey uuid;
+        if (!SenderKey::parseUuid(value.text, uuid)) {
+            return putArg(value.text);
+        }
+        if (room() < 17) {
+            return false;
+        }
+        char bytes[16];
+        uuid.uuidBytes(bytes);
+        put('U');
+        for (char byte : bytes) {
+            put(static_cast<uint8_t>(byte));
+        }
+        return true;
+    }
+
+    bool putTaggedVarint(char tag, uint64_t value) {
+        if (room() < 1 + varintSize(value)) {
+            return false;
+        }
+        put(tag);
+        putVarint(value);
+        return true;
+    }
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, bool>::type
+    putArg(T value) {
+        const int64_t v = value;
+        return putTaggedVarint('i', (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, bool>::type
+    putArg(T value) {
+        return putTaggedVarint('u', value);
+    }
+
+    void putArgs() {}
+
+    template<class Arg, class... Args>
+    void putArgs(const Arg& arg, const Args&... args) {
+        m_Reserved = maxSizes(args...);
+        if (putArg(arg)) {
+            putArgs(args...);
+        }
+    }
+
+public:
+    template<class... Args>
+    StringView encode(LogToken token, const Args&... args) {
+        m_Size = HEADER;
+        put(static_cast<uint8_t>(token));
+        putArgs(args...);
+        const size_t body = m_Size - HEADER;
+        size_t start = HEADER;
+        if (body > 0x7f) {
+            m_Data[--start] = static_cast<uint8_t>(body >> 7);
+            m_Data[--start] = static_cast<uint8_t>((body & 0x7f) | 0x80);
+        } else {
+            m_Data[--start] = static_cast<uint8_t>(body);
+        }
+        m_Data[--start] = LOG_FRAME_MARKER;
+        return StringView(reinterpret_cast<const char*>(m_Data + start), m_Size - start);
+    }
+};
+
+// Sends one log message to `device` (an I_Device), as text or as a tokenized frame
+template<class Device, class... Args>
+void logMessage(Device& device, LogToken token, const Args&... args) {
+    if (!device.logEnabled()) {
+        return;
+    }
+#ifdef CHECKMEET_LOG_TOKENIZED
+    LogFrame frame;
+    device.log(frame.encode(token, args...));
+#else
+    InlineString<256> text; // longer messages are truncated
+    renderLog(text, logFormat(token), args...);
+    device.log(text);
+#endif
+}
+
+// Arguments are the device, a LogToken and the values for the token's format
+#define CHECKMEET_LOG_NOTHING(...) do {} while (false)
+
+#if CHECKMEET_LOG_LEVEL >= CHECKMEET_LOG_LEVEL_ERROR
+#define CHECKMEET_LOG_ERROR logMessage
+#else
+#define CHECKMEET_LOG_ERROR CHECKMEET_LOG_NOTHING
+#endif
+
+#if CHECKMEET_LOG_LEVEL >= CHECKMEET_LOG_LEVEL_INFO
+#define CHECKMEET_LOG_INFO logMessage
+#else
+#define CHECKMEET_LOG_INFO CHECKMEET_LOG_NOTHING
+#endif
+
+#if CHECKMEET_LOG_LEVEL >= CHECKMEET_LOG_LEVEL_DEBUG
+#define CHECKMEET_LOG_DEBUG logMessage
+#else
+#define CHECKMEET_LOG_DEBUG CHECKMEET_LOG_NOTHING
+#endif
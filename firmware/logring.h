@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+
+#include "stdextra.h"
+
+// Fixed size byte ring buffer for log output. append() never blocks: a
+// message that doesn't fit is dropped as a whole, so the output never
+// contains partial messages. drain() hands the buffered bytes to a writer
+// when the caller has time for it.
+template<size_t Capacity>
+class LogRing {
+    char m_Buffer[Capacity];
+    size_t m_Start = 0; // oldest buffered byte
+    size_t m_Size = 0;
+    unsigned long m_DroppedBytes = 0;
+    unsigned long m_DroppedMessages = 0;
+
+public:
+    static constexpr size_t capacity() { return Capacity; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+    unsigned long droppedBytes() const { return m_DroppedBytes; }
+    unsigned long droppedMessages() const { return m_DroppedMessages; }
+
+    // Returns false if the message was dropped
+    bool append(StringView message) {
+        if (message.size() > Capacity - m_Size) {
+            m_DroppedBytes += message.size();
+            ++m_DroppedMessages;
+            return false;
+        }
+        const size_t end = (m_Start + m_Size) % Capacity;
+        const size_t first = std::min(message.size(), Capacity - end);
+        std::memcpy(m_Buffer + end, message.data(), first);
+        std::memcpy(m_Buffer, message.data() + first, message.size() - first);
+        m_Size += message.size();
+        return true;
+    }
+
+    // Passes at most `maxBytes` buffered bytes to `write(const char* data, size_t size)`,
+    // which returns how many of them it consumed. Returns the number of bytes drained.
+    template<class Writer>
+    size_t drain(size_t maxBytes, Writer write) {
+        size_t drained = 0;
+        while (m_Size && drained < maxBytes) {
+            const size_t chunk = std::min(std::min(m_Size, Capacity - m_Start), maxBytes - drained);
+            const size_t written = std::min<size_t>(write(m_Buffer + m_Start, chunk), chunk);
+            m_Start = (m_Start + written) % Capacity;
+            m_Size -= written;
+            drained += written;
+            if (written < chunk) {
+                break;
+            }
+        }
+        return drained;
+    }
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+// Every log message, as X(name, format). `{}` in the format is replaced by the
+// next argument. The position of an entry is its token on the wire when
+// CHECKMEET_LOG_TOKENIZED is defined, and logdecode.py reads this file to turn
+// tokens back into text: only ever append new entries at the end.
+#define CHECKMEET_LOG_TOKENS(X) \
+    X(UdpPacketContents, "UDP packet contents: {}\n") \
+    X(ParseFailed, "Invalid status message: {}\n") \
+    X(Version, "version {}\n") \
+    X(SenderId, "senderId {}\n") \
+    X(Microphone, "microphone {}\n") \
+    X(Webcam, "webcam {}\n") \
+    X(TooManyClients, "Too many clients, packet ignored\n") \
+    X(NewClient, "New client, {} tracked\n") \
+    X(ClientTimedOut, "Client timed out, {} tracked\n") \
+    X(UdpReceived, "Received {} bytes from {}, port {}\n") \
+    X(ButtonChanged, "button goes {}\n") \
+    X(HardwareWrites, "hardware writes: {} forwarded, {} suppressed\n") \
+    X(LogBytesDropped, "log bytes dropped: {}\n") \
+    X(BatchFrame, "Batch of {} statuses\n")
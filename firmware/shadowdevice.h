@@ -0,0 +1,104 @@
+#pragma once
+
+#include "lib_firmware.h"
+
+// I_Device decorator that remembers the last state written to the wrapped
+// device and forwards only real changes. Hardware writes are slow on the
+// device (TM1637 bit-banging, FastLED.show() with interrupts off), while
+// Firmware sets the same state over and over.
+class ShadowDevice : public I_Device {
+    I_Device& m_Device;
+
+    template<class T>
+    struct Shadow {
+        T value = T();
+        bool known = false;
+
+        // Returns true if `newValue` has to be written through
+        bool update(T newValue) {
+            if (known && value == newValue) {
+                return false;
+            }
+            value = newValue;
+            known = true;
+            return true;
+        }
+    };
+    Shadow<Color> m_Microphone;
+    Shadow<Color> m_Webcam;
+    Shadow<int> m_Display;
+
+    unsigned long m_Forwarded = 0;
+    unsigned long m_Suppressed = 0;
+
+    // The wrapped device only sees frames that change something
+    bool m_InFrame = false;
+    bool m_FrameForwarded = false;
+
+    void forwardFrameBegin() {
+        if (m_InFrame && !m_FrameForwarded) {
+            m_Device.beginLedFrame();
+            m_FrameForwarded = true;
+        }
+    }
+
+    template<class T>
+    bool track(Shadow<T>& shadow, T value) {
+        if (shadow.update(value)) {
+            ++m_Forwarded;
+            return true;
+        }
+        ++m_Suppressed;
+        return false;
+    }
+
+public:
+    explicit ShadowDevice(I_Device& device)
+        : m_Device(device)
+    {}
+
+    // Number of hardware writes passed to / filtered from the wrapped device
+    unsigned long forwardedWrites() const { return m_Forwarded; }
+    unsigned long suppressedWrites() const { return m_Suppressed; }
+
+    virtual void log(StringView message) override {
+        m_Device.log(message);
+    }
+
+    virtual bool logEnabled() const override {
+        return m_Device.logEnabled();
+    }
+
+    virtual void beginLedFrame() override {
+        m_InFrame = true;
+        m_FrameForwarded = false;
+    }
+
+    virtual void setMicrophoneLeds(Color color) override {
+        if (track(m_Microphone, color)) {
+            forwardFrameBegin();
+            m_Device.setMicrophoneLeds(color);
+        }
+    }
+
+    virtual void setWebcamLeds(Color color) override {
+        if (track(m_Webcam, color)) {
+            forwardFrameBegin();
+            m_Device.setWebcamLeds(color);
+        }
+    }
+
+    virtual void commitLedFrame() override {
+        if (m_FrameForwarded) {
+            m_Device.commitLedFrame();
+        }
+        m_InFrame = false;
+        m_FrameForwarded = false;
+    }
+
+    virtual void displayNumber(int number) override {
+        if (track(m_Display, number)) {
+            m_Device.displayNumber(number);
+        }
+    }
+};
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "clienttable.h"
+#include "stdextra.h"
+
+#define ARDUINOJSON_ENABLE_STD_STRING 1
+#include "ArduinoJson-v6.18.0.h"
+
+// Contents of a status message, see doc/Protocol.md
+struct StatusMessage {
+    int version = 0;
+    StringView senderId; // v1 only, data() is null if the message has no senderId
+    SenderKey senderUuid; // v2 only, the sender's UUID in binary
+    uint32_t sequence = 0;
+    bool hasSequence = false;
+    bool microphone = false;
+    bool webcam = false;
+
+    bool hasSenderId() const { return senderId.data() != nullptr; }
+};
+
+// Layout of the binary v2 status frame. Its first byte can't start a JSON
+// document (nor UTF-8 text), which is how the two are told apart on one port.
+struct StatusFrame {
+    static constexpr uint8_t MAGIC = 0xc1;
+    static constexpr uint8_t VERSION = 2;
+    static constexpr uint8_t FLAG_MICROPHONE = 1 << 0;
+    static constexpr uint8_t FLAG_WEBCAM = 1 << 1;
+    static constexpr uint8_t FLAG_SEQUENCE = 1 << 2;
+    static constexpr uint8_t FLAG_BATCH = 1 << 3; // the statuses of several senders follow
+    static constexpr size_t HEADER_SIZE = 3; // magic, version, flags
+    static constexpr size_t UUID_SIZE = 16;
+    static constexpr size_t SIZE = HEADER_SIZE + UUID_SIZE; // without the sequence number
+    static constexpr size_t SEQUENCE_SIZE = 4;
+
+    // A batch has a count after the header, then that many entries of a flags byte
+    // (microphone and webcam only) and a UUID. 14 entries fit the 255 byte receive buffer.
+    static constexpr size_t BATCH_HEADER_SIZE = HEADER_SIZE + 1;
+    static constexpr size_t BATCH_ENTRY_SIZE = 1 + UUID_SIZE;
+    static constexpr size_t MAX_BATCH_ENTRIES = 14;
+};
+
+// Encoders for what StatusParser::decodeFrame() and decodeBatchEntry() read, for
+// relays, tests and benchmarks. `Out` is a string type with append(data, size).
+
+// A v2 frame with the message's flags, senderUuid and, if it has one, sequence number
+template<class Out>
+void appendStatusFrame(Out& out, const StatusMessage& message) {
+    const char header[StatusFrame::HEADER_SIZE] = {
+        static_cast<char>(StatusFrame::MAGIC),
+        static_cast<char>(StatusFrame::VERSION),
+        static_cast<char>((message.microphone ? StatusFrame::FLAG_MICROPHONE : 0) | (message.webcam ? StatusFrame::FLAG_WEBCAM : 0)
+            | (message.hasSequence ? StatusFrame::FLAG_SEQUENCE : 0)),
+    };
+    out.append(header, sizeof(header));
+    char uuid[StatusFrame::UUID_SIZE];
+    message.senderUuid.uuidBytes(uuid);
+    out.append(uuid, sizeof(uuid));
+    if (message.hasSequence) {
+        const char sequence[StatusFrame::SEQUENCE_SIZE] = {
+            static_cast<char>(message.sequence >> 24), static_cast<char>(message.sequence >> 16),
+            static_cast<char>(message.sequence >> 8), static_cast<char>(message.sequence),
+        };
+        out.append(sequence, sizeof(sequence));
+    }
+}
+
+// A batch frame with an entry for each message, of which there may be up to MAX_BATCH_ENTRIES
+template<class Out>
+void appendBatchFrame(Out& out, Span<const StatusMessage> messages) {
+    const char header[StatusFrame::BATCH_HEADER_SIZE] = {
+        static_cast<char>(StatusFrame::MAGIC),
+        static_cast<char>(StatusFrame::VERSION),
+        static_cast<char>(StatusFrame::FLAG_BATCH),
+        static_cast<char>(messages.size()),
+    };
+    out.append(header, sizeof(header));
+    for (const StatusMessage& message : messages) {
+        const char flags = static_cast<char>((message.microphone ? StatusFrame::FLAG_MICROPHONE : 0) | (message.webcam ? StatusFrame::FLAG_WEBCAM : 0));
+        out.append(&flags, 1);
+        char uuid[StatusFrame::UUID_SIZE];
+        message.senderUuid.uuidBytes(uuid);
+        out.append(uuid, sizeof(uuid));
+    }
+}
+
+// Parser for status messages. Binary v2 frames are decoded directly. For v1 JSON
+// the minified form service.py sends is matched directly, 8 bytes at a time.
+// Anything else, and v1 maps encoded as MessagePack, go through ArduinoJson and
+// are checked against the schema's required fields and their types.
+class StatusParser {
+    StaticJsonDocument<256> m_Doc;
+
+    static uint64_t load64(const char* p) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        return word;
+    }
+
+    // Consumes `literal` if the input continues with it
+    template<size_t N>
+    static bool skipLiteral(const char*& p, const char* end, const char (&literal)[N]) {
+        const size_t size = N - 1;
+        if (static_cast<size_t>(end - p) < size) {
+            return false;
+        }
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            if (load64(p + i) != load64(literal + i)) {
+                return false;
+            }
+        }
+        if (std::memcmp(p + i, literal + i, size - i) != 0) {
+            return false;
+        }
+        p += size;
+        return true;
+    }
+
+    static bool skipBool(const char*& p, const char* end, bool& value) {
+        value = true;
+        if (skipLiteral(p, end, "true")) {
+            return true;
+        }
+        value = false;
+        return skipLiteral(p, end, "false");
+    }
+
+    static constexpr uint64_t ONES = 0x0101010101010101ULL;
+    static constexpr uint64_t HIGH = 0x8080808080808080ULL;
+
+    // Non-zero if any byte of `word` is less than `limit`, which must be at most 0x80
+    static uint64_t bytesBelow(uint64_t word, uint8_t limit) {
+        return (word - ONES * limit) & ~word & HIGH;
+    }
+
+    // Non-zero if any byte of `word` is '"', '\\' or a control character
+    static uint64_t specialBytes(uint64_t word) {
+        return bytesBelow(word ^ (ONES * '"'), 1) | bytesBelow(word ^ (ONES * '\\'), 1) | bytesBelow(word, 0x20);
+    }
+
+    // Consumes the body of a string without escapes up to its closing quote
+    static bool skipPlainString(const char*& p, const char* end, StringView& value) {
+        const char* const begin = p;
+        while (end - p >= 8 && !specialBytes(load64(p))) {
+            p += 8;
+        }
+        for (; p != end; ++p) {
+            const unsigned char c = static_cast<unsigned char>(*p);
+            if (c == '"') {
+                value = StringView(begin, p - begin);
+                ++p;
+                return true;
+            }
+            if (c == '\\' || c < 0x20) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Checks the parsed document against the schema
+    const char* readDocument(StatusMessage& message) const {
+        const JsonDocument& doc = m_Doc;
+        if (!doc.is<JsonObjectConst>()) {
+            return "not an object";
+        }
+        const JsonVariantConst version = doc["version"];
+        const JsonVariantConst microphone = doc["microphone"];
+        const JsonVariantConst webcam = doc["webcam"];
+        const JsonVariantConst senderId = doc["senderId"];
+        if (!version.is<int>() || version.as<int>() != 1) {
+            return "missing or unsupported version";
+        }
+        if (!microphone.is<bool>() || !webcam.is<bool>()) {
+            return "missing microphone or webcam";
+        }
+        if (!senderId.isNull() && !senderId.is<const char*>()) {
+            return "senderId is not a string";
+        }
+        message.version = 1;
+        message.microphone = microphone.as<bool>();
+        message.webcam = webcam.as<bool>();
+        message.senderId = senderId.isNull() ? StringView() : StringView(senderId.as<const char*>());
+        return nullptr;
+    }
+
+    const char* parseAnyJson(StringView packet, StatusMessage& message) {
+        const DeserializationError error = deserializeJson(m_Doc, packet.data(), packet.size());
+        if (error) {
+            return error.c_str();
+        }
+        return readDocument(message);
+    }
+
+    // Big endian, as all multi-byte fields of the frame
+    static uint64_t readBigEndian(const char* p, size_t size) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; ++i) {
+            value = (value << 8) | static_cast<uint8_t>(p[i]);
+        }
+        return value;
+    }
+
+public:
+    // The exact layout the service sends, see doc/Protocol.md. False for any other
+    // JSON, which parse() hands to the general parser.
+    static bool parseMinified(StringView packet, StatusMessage& message) {
+        const char* p = packet.begin();
+        const char* const end = packet.end();
+        if (!skipLiteral(p, end, R"({"version":1,"webcam":)") || !skipBool(p, end, message.webcam)
+                || !skipLiteral(p, end, R"(,"microphone":)") || !skipBool(p, end, message.microphone)) {
+            return false;
+        }
+        message.version = 1;
+        message.senderId = StringView();
+        if (skipLiteral(p, end, R"(,"senderId":")") && !skipPlainString(p, end, message.senderId)) {
+            return false;
+        }
+        return skipLiteral(p, end, "}") && p == end;
+    }
+
+    static bool isFrame(StringView packet) {
+        return packet.size() && static_cast<uint8_t>(packet.data()[0]) == StatusFrame::MAGIC;
+    }
+
+    // A MessagePack map (fixmap, map 16 or map 32). JSON text starts with '{' or
+    // whitespace instead, and the binary frame with its magic.
+    static bool isMsgPack(StringView packet) {
+        if (!packet.size()) {
+            return false;
+        }
+        const uint8_t first = static_cast<uint8_t>(packet.data()[0]);
+        return (first & 0xf0) == 0x80 || first == 0xde || first == 0xdf;
+    }
+
+    // Same fields and rules as the JSON form
+    const char* parseMsgPack(StringView packet, StatusMessage& message) {
+        const DeserializationError error = deserializeMsgPack(m_Doc, packet.data(), packet.size());
+        if (error) {
+            return error.c_str();
+        }
+        return readDocument(message);
+    }
+
+    // JSON, anything else is binary
+    static bool isText(StringView packet) {
+        return !isFrame(packet) && !isMsgPack(packet);
+    }
+
+    static bool isBatchFrame(StringView packet) {
+        return isFrame(packet) && packet.size() >= StatusFrame::HEADER_SIZE
+            && (static_cast<uint8_t>(packet.data()[2]) & StatusFrame::FLAG_BATCH);
+    }
+
+    // Validates a whole batch frame, so that it can be applied all or nothing.
+    // Returns null and the number of entries on success.
+    static const char* checkBatchFrame(StringView packet, size_t& count) {
+        const char* p = packet.data();
+        if (!isBatchFrame(packet) || packet.size() < StatusFrame::BATCH_HEADER_SIZE) {
+            return "not a batch frame";
+        }
+        if (static_cast<uint8_t>(p[1]) != StatusFrame::VERSION) {
+            return "unsupported frame version";
+        }
+        if (static_cast<uint8_t>(p[2]) != StatusFrame::FLAG_BATCH) {
+            return "unknown frame flags";
+        }
+        count = static_cast<uint8_t>(p[3]);
+        if (count == 0 || count > StatusFrame::MAX_BATCH_ENTRIES
+                || packet.size() != StatusFrame::BATCH_HEADER_SIZE + count * StatusFrame::BATCH_ENTRY_SIZE) {
+            return "wrong batch size";
+        }
+        for (size_t i = 0; i < count; ++i) {
+            const uint8_t flags = static_cast<uint8_t>(p[StatusFrame::BATCH_HEADER_SIZE + i * StatusFrame::BATCH_ENTRY_SIZE]);
+            if (flags & ~(StatusFrame::FLAG_MICROPHONE | StatusFrame::FLAG_WEBCAM)) {
+                return "unknown entry flags";
+            }
+        }
+        return nullptr;
+    }
+
+    // Bytes of entry `index` of a batch frame that passed checkBatchFrame()
+    static StringView batchEntry(StringView packet, size_t index) {
+        return StringView(packet.data() + StatusFrame::BATCH_HEADER_SIZE + index * StatusFrame::BATCH_ENTRY_SIZE, StatusFrame::BATCH_ENTRY_SIZE);
+    }
+
+    static void decodeBatchEntry(StringView packet, size_t index, StatusMessage& message) {
+        const char* entry = batchEntry(packet, index).data();
+        const uint8_t flags = static_cast<uint8_t>(entry[0]);
+        message.version = StatusFrame::VERSION;
+        message.microphone = flags & StatusFrame::FLAG_MICROPHONE;
+        message.webcam = flags & StatusFrame::FLAG_WEBCAM;
+        message.senderId = StringView();
+        message.senderUuid.hi = readBigEndian(entry + 1, 8);
+        message.senderUuid.lo = readBigEndian(entry + 9, 8);
+        message.hasSequence = false;
+        message.sequence = 0;
+    }
+
+    // Needs no parser state, the frame has a fixed layout
+    static const char* decodeFrame(StringView packet, StatusMessage& message) {
+        const char* p = packet.data();
+        if (packet.size() < StatusFrame::HEADER_SIZE || static_cast<uint8_t>(p[0]) != StatusFrame::MAGIC) {
+            return "not a status frame";
+        }
+        if (static_cast<uint8_t>(p[1]) != StatusFrame::VERSION) {
+            return "unsupported frame version";
+        }
+        const uint8_t flags = static_cast<uint8_t>(p[2]);
+        if (flags & ~(StatusFrame::FLAG_MICROPHONE | StatusFrame::FLAG_WEBCAM | StatusFrame::FLAG_SEQUENCE)) {
+            return "unknown frame flags";
+        }
+        message.hasSequence = flags & StatusFrame::FLAG_SEQUENCE;
+        if (packet.size() != StatusFrame::SIZE + StatusFrame::SEQUENCE_SIZE * message.hasSequence) {
+            return "wrong frame size";
+        }
+        message.version = StatusFrame::VERSION;
+        message.microphone = flags & StatusFrame::FLAG_MICROPHONE;
+        message.webcam = flags & StatusFrame::FLAG_WEBCAM;
+        message.senderId = StringView();
+        message.senderUuid.hi = readBigEndian(p + StatusFrame::HEADER_SIZE, 8);
+        message.senderUuid.lo = readBigEndian(p + StatusFrame::HEADER_SIZE + 8, 8);
+        message.sequence = message.hasSequence ? static_cast<uint32_t>(readBigEndian(p + StatusFrame::SIZE, StatusFrame::SEQUENCE_SIZE)) : 0;
+        return nullptr;
+    }
+
+    // Returns null on success, otherwise the reason the packet was rejected.
+    // `message.senderId` points into `packet` or into the parser.
+    const char* parse(StringView packet, StatusMessage& message) {
+        if (isFrame(packet)) {
+            return decodeFrame(packet, message);
+        }
+        if (isMsgPack(packet)) {
+            return parseMsgPack(packet, message);
+        }
+        if (parseMinified(packet, message)) {
+            return nullptr;
+        }
+        return parseAnyJson(packet, message);
+    }
+};
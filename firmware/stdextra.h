@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdarg>
-#include <unordered_map>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
 
 template<class T, class... Args>
 std::unique_ptr<T> make_unique(Args&&... args)
@@ -41,6 +46,81 @@ using StringView = Span<const char>;
 
 inline StringView operator "" _sv(const char* str, std::size_t len) { return StringView(str, len); }
 
+// 64-bit FNV-1a, `seed` selects independent hash functions
+inline uint64_t hashBytes(StringView bytes, uint64_t seed = 0) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+    for (char c : bytes) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// String with fixed capacity stored in place, appending never allocates
+// and cuts the string at the capacity instead
+template<size_t Capacity>
+class InlineString {
+    char m_Data[Capacity + 1];
+    size_t m_Size = 0;
+
+public:
+    InlineString() { m_Data[0] = '\0'; }
+
+    static constexpr size_t capacity() { return Capacity; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+    const char* data() const { return m_Data; }
+    const char* c_str() const { return m_Data; }
+    const char* begin() const { return m_Data; }
+    const char* end() const { return m_Data + m_Size; }
+
+    void clear() {
+        m_Size = 0;
+        m_Data[0] = '\0';
+    }
+
+    // Returns false if the string had to be truncated
+    bool append(const char* data, size_t size) {
+        const size_t count = std::min(size, Capacity - m_Size);
+        std::memcpy(m_Data + m_Size, data, count);
+        m_Size += count;
+        m_Data[m_Size] = '\0';
+        return count == size;
+    }
+    bool append(const char* str) { return append(str, std::strlen(str)); }
+
+    // printf-style append in a single pass, returns false if the result had to be truncated
+    bool vappendf(const char* format, va_list args) {
+        const int len = vsnprintf(m_Data + m_Size, Capacity + 1 - m_Size, format, args);
+        if (len < 0) {
+            m_Data[m_Size] = '\0';
+            return false;
+        }
+        const size_t wanted = m_Size + static_cast<size_t>(len);
+        m_Size = std::min(wanted, Capacity);
+        return wanted <= Capacity;
+    }
+
+    bool operator==(StringView other) const {
+        return other.size() == m_Size && std::memcmp(other.data(), m_Data, m_Size) == 0;
+    }
+    bool operator!=(StringView other) const { return !(*this == other); }
+};
+
+// Formats into `out` without allocating. Returns false if the result was truncated.
+template<size_t Capacity>
+#ifdef __GNUC__
+__attribute__((format(printf, 2, 3)))
+#endif
+bool fmt(InlineString<Capacity>& out, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    out.clear();
+    const bool complete = out.vappendf(format, args);
+    va_end(args);
+    return complete;
+}
+
 #ifdef __GNUC__
 __attribute__((format(printf, 1, 2)))
 #endif
@@ -56,18 +136,3 @@ inline std::string fmt(const char* format, ...) {
     va_end(args2);
     return result;
 }
-
-template< class Key, class T, class Hash, class KeyEqual, class Alloc, class Pred >
-typename std::unordered_map<Key, T, Hash, KeyEqual, Alloc>::size_type
-erase_if(std::unordered_map<Key, T, Hash, KeyEqual, Alloc>& c, Pred pred) {
-    auto old_size = c.size();
-    for (auto i = c.begin(), last = c.end(); i != last; ) {
-        if (pred(*i)) {
-            i = c.erase(i);
-        }
-        else {
-            ++i;
-        }
-    }
-    return old_size - c.size();
-}
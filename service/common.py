@@ -1,8 +1,162 @@
 import datetime
+import struct
+import uuid
 
 MAX_JSON_LENGTH = 250
 
+# Binary status frame (protocol v2), see doc/Protocol.md
+FRAME_MAGIC = 0xc1
+FRAME_VERSION = 2
+FRAME_FLAG_MICROPHONE = 0x01
+FRAME_FLAG_WEBCAM = 0x02
+FRAME_FLAG_SEQUENCE = 0x04
+FRAME_FLAG_BATCH = 0x08
+FRAME_BATCH_ENTRY = struct.Struct('>B16s')
+FRAME_MAX_BATCH_ENTRIES = 14 # keeps a batch frame within 255 bytes
+FRAME_HEADER = struct.Struct('>BBB16s')
+FRAME_SEQUENCE = struct.Struct('>I')
+
 def log(msg):
     now = datetime.datetime.now()
     ts = f'{now.hour:02}:{now.minute:02}:{now.second:02}'
     print(f'[{ts}] {msg}')
+
+# The subset of MessagePack a status map needs: maps, strings, booleans, integers and nil
+def encode_msgpack(obj):
+    if obj is None:
+        return b'\xc0'
+    if isinstance(obj, bool):
+        return b'\xc3' if obj else b'\xc2'
+    if isinstance(obj, int):
+        if 0 <= obj < 0x80:
+            return struct.pack('>B', obj)
+        if -32 <= obj < 0:
+            return struct.pack('>b', obj)
+        return struct.pack('>Bq', 0xd3, obj)
+    if isinstance(obj, str):
+        data = obj.encode('utf-8')
+        if len(data) < 32:
+            return struct.pack('>B', 0xa0 | len(data)) + data
+        if len(data) < 0x100:
+            return struct.pack('>BB', 0xd9, len(data)) + data
+        return struct.pack('>BH', 0xda, len(data)) + data
+    if isinstance(obj, dict):
+        if len(obj) < 16:
+            header = struct.pack('>B', 0x80 | len(obj))
+        else:
+            header = struct.pack('>BH', 0xde, len(obj))
+        return header + b''.join(encode_msgpack(k) + encode_msgpack(v) for k, v in obj.items())
+    raise TypeError(f'cannot encode {type(obj).__name__} as MessagePack')
+
+# Status maps start with a fixmap or map 16/32 header, JSON with '{'
+def is_msgpack(data):
+    return len(data) > 0 and (data[0] & 0xf0 == 0x80 or data[0] in (0xde, 0xdf))
+
+# Counterpart of encode_msgpack(), raises ValueError for anything outside its subset
+def decode_msgpack(data):
+    def read(pos, size):
+        if pos + size > len(data):
+            raise ValueError('truncated MessagePack')
+        return data[pos:pos + size], pos + size
+
+    def value(pos):
+        (first,), pos = read(pos, 1)
+        if first < 0x80:
+            return first, pos
+        if first >= 0xe0:
+            return first - 0x100, pos
+        if first == 0xc0:
+            return None, pos
+        if first in (0xc2, 0xc3):
+            return first == 0xc3, pos
+        if first == 0xd3:
+            raw, pos = read(pos, 8)
+            return struct.unpack('>q', raw)[0], pos
+        if first & 0xe0 == 0xa0 or first in (0xd9, 0xda):
+            if first & 0xe0 == 0xa0:
+                size = first & 0x1f
+            else:
+                raw, pos = read(pos, 1 if first == 0xd9 else 2)
+                size = int.from_bytes(raw, 'big')
+            raw, pos = read(pos, size)
+            return raw.decode('utf-8'), pos
+        if first & 0xf0 == 0x80 or first == 0xde:
+            if first == 0xde:
+                raw, pos = read(pos, 2)
+                count = int.from_bytes(raw, 'big')
+            else:
+                count = first & 0x0f
+            obj = {}
+            for _ in range(count):
+                k, pos = value(pos)
+                obj[k], pos = value(pos)
+            return obj, pos
+        raise ValueError(f'unsupported MessagePack type {first:#04x}')
+
+    obj, pos = value(0)
+    if pos != len(data):
+        raise ValueError('trailing bytes after MessagePack value')
+    return obj
+
+def encode_frame(sender_id, webcam, microphone, sequence=None):
+    flags = (FRAME_FLAG_WEBCAM if webcam else 0) | (FRAME_FLAG_MICROPHONE if microphone else 0)
+    if sequence is not None:
+        flags |= FRAME_FLAG_SEQUENCE
+    frame = FRAME_HEADER.pack(FRAME_MAGIC, FRAME_VERSION, flags, uuid.UUID(sender_id).bytes)
+    if sequence is not None:
+        frame += FRAME_SEQUENCE.pack(sequence & 0xffffffff)
+    return frame
+
+# For relays: (sender_id, webcam, microphone) tuples packed into as few batch frames as possible
+def encode_batch_frames(entries):
+    frames = []
+    for first in range(0, len(entries), FRAME_MAX_BATCH_ENTRIES):
+        chunk = entries[first:first + FRAME_MAX_BATCH_ENTRIES]
+        frame = struct.pack('>BBBB', FRAME_MAGIC, FRAME_VERSION, FRAME_FLAG_BATCH, len(chunk))
+        for sender_id, webcam, microphone in chunk:
+            flags = (FRAME_FLAG_WEBCAM if webcam else 0) | (FRAME_FLAG_MICROPHONE if microphone else 0)
+            frame += FRAME_BATCH_ENTRY.pack(flags, uuid.UUID(sender_id).bytes)
+        frames.append(frame)
+    return frames
+
+def decode_batch_frame(data):
+    if len(data) < 4 or data[0] != FRAME_MAGIC or data[1] != FRAME_VERSION or data[2] != FRAME_FLAG_BATCH:
+        raise ValueError('not a batch frame')
+    count = data[3]
+    if count == 0 or count > FRAME_MAX_BATCH_ENTRIES or len(data) != 4 + count * FRAME_BATCH_ENTRY.size:
+        raise ValueError(f'wrong size for {count} entries: {len(data)} bytes')
+    entries = []
+    for flags, sender_uuid in FRAME_BATCH_ENTRY.iter_unpack(data[4:]):
+        if flags & ~(FRAME_FLAG_MICROPHONE | FRAME_FLAG_WEBCAM):
+            raise ValueError(f'unknown entry flags: {flags:#04x}')
+        entries.append({
+            'webcam': bool(flags & FRAME_FLAG_WEBCAM),
+            'microphone': bool(flags & FRAME_FLAG_MICROPHONE),
+            'senderId': str(uuid.UUID(bytes=sender_uuid)),
+        })
+    return entries
+
+# Returns the frame's contents with the same keys as the JSON message, raises ValueError if it's malformed
+def decode_frame(data):
+    if len(data) >= 3 and data[2] & FRAME_FLAG_BATCH:
+        return {'version': FRAME_VERSION, 'batch': decode_batch_frame(data)}
+    if len(data) < FRAME_HEADER.size:
+        raise ValueError(f'frame is too short: {len(data)} bytes')
+    magic, version, flags, sender_uuid = FRAME_HEADER.unpack_from(data)
+    if magic != FRAME_MAGIC or version != FRAME_VERSION:
+        raise ValueError(f'not a v{FRAME_VERSION} frame')
+    if flags & ~(FRAME_FLAG_MICROPHONE | FRAME_FLAG_WEBCAM | FRAME_FLAG_SEQUENCE):
+        raise ValueError(f'unknown flags: {flags:#04x}')
+    has_sequence = bool(flags & FRAME_FLAG_SEQUENCE)
+    expected = FRAME_HEADER.size + (FRAME_SEQUENCE.size if has_sequence else 0)
+    if len(data) != expected:
+        raise ValueError(f'frame is {len(data)} bytes instead of {expected}')
+    obj = {
+        'version': version,
+        'webcam': bool(flags & FRAME_FLAG_WEBCAM),
+        'microphone': bool(flags & FRAME_FLAG_MICROPHONE),
+        'senderId': str(uuid.UUID(bytes=sender_uuid)),
+    }
+    if has_sequence:
+        obj['sequence'] = FRAME_SEQUENCE.unpack_from(data, FRAME_HEADER.size)[0]
+    return obj
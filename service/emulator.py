@@ -29,8 +29,23 @@ def main():
             common.log('User pressed Ctrl+C, aborting')
             break
 
-        msg = data.decode("utf-8")
-        obj = json.loads(msg)
+        if data[:1] == bytes([common.FRAME_MAGIC]):
+            try:
+                common.log(f'<{addr[0]}> {common.decode_frame(data)}')
+            except ValueError as e:
+                common.log(f'Frame is not ok: {e}')
+            continue
+
+        if common.is_msgpack(data):
+            try:
+                obj = common.decode_msgpack(data)
+            except ValueError as e:
+                common.log(f'MessagePack is not ok: {e}')
+                continue
+            msg = json.dumps(obj)
+        else:
+            msg = data.decode("utf-8")
+            obj = json.loads(msg)
 
         common.log(f'<{addr[0]}> {msg}')
         if len(msg) > common.MAX_JSON_LENGTH:
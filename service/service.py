@@ -13,11 +13,25 @@ import driver_auto as driver
 
 APPNAME = 'CheckMeet'
 
+# Numbers the binary status frames. The number only advances when the status
+# changes, so heartbeats repeat the last frame byte for byte and the device can
+# skip parsing them.
+__sequence = itertools.count()
+__sequenced_status = None
+__sequence_number = 0
+
+def __sequence_for(status):
+    global __sequenced_status, __sequence_number
+    if status != __sequenced_status:
+        __sequenced_status = status
+        __sequence_number = next(__sequence)
+    return __sequence_number
+
 def sendudp(ip, port, msg):
     assert(len(msg) <= common.MAX_JSON_LENGTH)
     sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM) # UDP
     try:
-        sock.sendto(bytes(msg, 'utf-8'), (ip, port))
+        sock.sendto(msg, (ip, port))
     except OSError as e:
         common.log(f'Couldn\'t send over UDP: {e.strerror}')
 
@@ -53,17 +67,24 @@ def loopbody(args, counter, last_status):
         # Application quitting
         status = (False, False)
 
-    msg = json.dumps(
-        {
+    if args.protocol == 'binary':
+        msg = common.encode_frame(args.sender_id, status[0], status[1], __sequence_for(status))
+        common.log(msg.hex())
+    else:
+        obj = {
             "version": 1,
             "webcam": status[0],
             "microphone": status[1],
             "senderId": args.sender_id
-        },
-        separators=(',', ':')
-    )
+        }
+        if args.protocol == 'msgpack':
+            common.log(obj)
+            msg = common.encode_msgpack(obj)
+        else:
+            text = json.dumps(obj, separators=(',', ':'))
+            common.log(text)
+            msg = bytes(text, 'utf-8')
 
-    common.log(msg)
     # Send message if status changed, or every Xth round
     if status != last_status or (counter % args.send_rate)==0:
         common.log('Sending UDP message...')
@@ -124,8 +145,14 @@ def main():
     parser.add_argument('--query_interval', default=1, type=int, help='Query status every X seconds')
     parser.add_argument('--send_rate', default=10, type=int, help='Send every Xth status')
     parser.add_argument('--sender_id', default=str(uuid.uuid4()), help='Unique ID identifying this computer')
+    parser.add_argument('--protocol', default='json', choices=['json', 'msgpack', 'binary'], help='Send JSON (v1), the same as MessagePack, or binary (v2) status messages')
     parser.add_argument('ip', nargs='*', help='Send UDP packets to these IP adresses')
     args = parser.parse_args()
+    if args.protocol == 'binary':
+        try:
+            uuid.UUID(args.sender_id)
+        except ValueError:
+            parser.error('the binary protocol needs a UUID as --sender_id')
 
     app = App(args)
     app.start()